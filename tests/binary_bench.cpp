@@ -0,0 +1,63 @@
+/*
+ * MessagePack、CBOR与文本dump()/parse()的对比
+ * 数据是以数字为主的时间序列，输出每种格式的体积以及编码、解码的耗时
+ * 只用来观察，不作为测试的通过条件
+ */
+#include "../tiny_json.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using json11::Json;
+
+static Json make_series(int points){
+    Json::array samples;
+    samples.reserve(points);
+    for(int i = 0; i < points; i++){
+        samples.push_back(Json::object{
+            {"t", 1700000000 + i},
+            {"value", 20.0 + (i % 1000) * 0.013},
+            {"count", i % 97},
+            {"ok", i % 7 != 0},
+        });
+    }
+    return Json::object{{"sensor", "bench"}, {"samples", std::move(samples)}};
+}
+
+// 重复rounds次，返回平均每次的毫秒数
+template<class F>
+static double time_ms(int rounds, F f){
+    const auto start = std::chrono::steady_clock::now();
+    for(int k = 0; k < rounds; k++){
+        f();
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rounds;
+}
+
+int main(int argc, char** argv){
+    const int points = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const int rounds = 5;
+    const Json doc = make_series(points);
+
+    const std::string text = doc.dump();
+    const std::string msgpack = doc.to_msgpack();
+    const std::string cbor = doc.to_cbor();
+
+    std::string err;
+    const double text_encode = time_ms(rounds, [&]{ std::string out; doc.dump(out); });
+    const double text_decode = time_ms(rounds, [&]{ Json::parse(text, err); });
+    const double msgpack_encode = time_ms(rounds, [&]{ std::string out; doc.to_msgpack(out); });
+    const double msgpack_decode = time_ms(rounds, [&]{ Json::from_msgpack(msgpack, err); });
+    const double cbor_encode = time_ms(rounds, [&]{ std::string out; doc.to_cbor(out); });
+    const double cbor_decode = time_ms(rounds, [&]{ Json::from_cbor(cbor, err); });
+
+    std::printf("%d samples, average of %d rounds\n", points, rounds);
+    std::printf("%-8s %12s %12s %12s\n", "format", "bytes", "encode ms", "decode ms");
+    std::printf("%-8s %12zu %12.2f %12.2f\n", "text", text.size(), text_encode, text_decode);
+    std::printf("%-8s %12zu %12.2f %12.2f\n", "msgpack", msgpack.size(), msgpack_encode, msgpack_decode);
+    std::printf("%-8s %12zu %12.2f %12.2f\n", "cbor", cbor.size(), cbor_encode, cbor_decode);
+    return 0;
+}
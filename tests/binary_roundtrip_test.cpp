@@ -0,0 +1,106 @@
+/*
+ * MessagePack和CBOR的往返测试
+ * 解码后的值要和原来相等，整数和浮点数的区别也要保留：再编码一次得到的字节必须完全相同
+ */
+#include "../tiny_json.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+using json11::Json;
+
+static int failures = 0;
+
+static void check(const char* what, bool ok){
+    if(!ok){
+        std::printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static std::string bytes(std::initializer_list<int> list){
+    std::string out;
+    for(int b : list){
+        out += static_cast<char>(b);
+    }
+    return out;
+}
+
+static void roundtrip(const char* what, const Json& value){
+    std::string err;
+    const std::string msgpack = value.to_msgpack();
+    const Json from_msgpack = Json::from_msgpack(msgpack, err);
+    check(what, err.empty() && from_msgpack == value && from_msgpack.to_msgpack() == msgpack);
+
+    const std::string cbor = value.to_cbor();
+    const Json from_cbor = Json::from_cbor(cbor, err);
+    check(what, err.empty() && from_cbor == value && from_cbor.to_cbor() == cbor);
+}
+
+// 解码单个数字并检查值和它是否按整数保存（整数1编码成一个字节）
+static void decode_number(const char* what, const std::string& in, bool cbor, double expected){
+    std::string err;
+    const Json value = cbor ? Json::from_cbor(in, err) : Json::from_msgpack(in, err);
+    const bool same = std::isnan(expected) ? std::isnan(value.number_value()) : value.number_value() == expected;
+    check(what, err.empty() && value.is_number() && same);
+}
+
+int main(){
+    roundtrip("null", Json());
+    roundtrip("true", Json(true));
+    roundtrip("false", Json(false));
+    for(int value : {0, 1, -1, 23, 24, -24, -25, 127, 128, -32, -33, 255, 256, 65535, 65536, -2147483647 - 1, 2147483647}){
+        roundtrip("int", Json(value));
+    }
+    for(double value : {0.0, -0.0, 1.0, 0.5, -2.25, 0.1, 1e300, -1e-300, 3.4028234663852886e38}){
+        roundtrip("double", Json(value));
+    }
+    roundtrip("string", Json(""));
+    roundtrip("long string", Json(std::string(70000, 'x')));
+    roundtrip("array", Json(Json::array{1, 1.0, "a", nullptr, Json::array{}, Json::object{}}));
+    roundtrip("object", Json(Json::object{{"int", 1}, {"double", 1.0}, {"nested", Json::object{{"k", Json::array{2.5}}}}}));
+
+    // 整数和浮点数即使值相等也要编码成不同的东西
+    check("msgpack int 1", Json(1).to_msgpack() == bytes({0x01}));
+    check("msgpack double 1.0 as float32", Json(1.0).to_msgpack() == bytes({0xca, 0x3f, 0x80, 0x00, 0x00}));
+    check("msgpack double 0.1 as float64", static_cast<uint8_t>(Json(0.1).to_msgpack()[0]) == 0xcb);
+    check("cbor int 1", Json(1).to_cbor() == bytes({0x01}));
+    check("cbor double 1.0 as float32", Json(1.0).to_cbor() == bytes({0xfa, 0x3f, 0x80, 0x00, 0x00}));
+    check("cbor double 0.1 as float64", static_cast<uint8_t>(Json(0.1).to_cbor()[0]) == 0xfb);
+
+    // 手写的字节：float32、float64以及CBOR的半精度
+    decode_number("msgpack 0xca", bytes({0xca, 0x40, 0x20, 0x00, 0x00}), false, 2.5);
+    decode_number("msgpack 0xcb", bytes({0xcb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a}), false, 0.1);
+    decode_number("cbor float32", bytes({0xfa, 0x40, 0x20, 0x00, 0x00}), true, 2.5);
+    decode_number("cbor float64", bytes({0xfb, 0x3f, 0xb9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a}), true, 0.1);
+    decode_number("cbor half 1.0", bytes({0xf9, 0x3c, 0x00}), true, 1.0);
+    decode_number("cbor half -2.0", bytes({0xf9, 0xc0, 0x00}), true, -2.0);
+    decode_number("cbor half 65504", bytes({0xf9, 0x7b, 0xff}), true, 65504.0);
+    decode_number("cbor half subnormal", bytes({0xf9, 0x00, 0x01}), true, std::ldexp(1.0, -24));
+    decode_number("cbor half infinity", bytes({0xf9, 0x7c, 0x00}), true, HUGE_VAL);
+    decode_number("cbor half nan", bytes({0xf9, 0x7e, 0x00}), true, NAN);
+
+    // 解码出来的浮点数仍然是浮点数，再编码时不会变成整数
+    std::string err;
+    check("cbor half stays double", Json::from_cbor(bytes({0xf9, 0x3c, 0x00}), err).to_cbor() == bytes({0xfa, 0x3f, 0x80, 0x00, 0x00}));
+    check("msgpack float32 stays double", Json::from_msgpack(bytes({0xca, 0x3f, 0x80, 0x00, 0x00}), err).to_msgpack()
+                                          == bytes({0xca, 0x3f, 0x80, 0x00, 0x00}));
+
+    // typed_arrays只连续保存同一种数字，混合的数组编码结果和普通解析一样
+    json11::ParseOptions typed;
+    typed.typed_arrays = true;
+    const Json mixed = Json::parse("[1, 2.5]", err, typed);
+    check("typed mixed array msgpack", mixed.to_msgpack() == Json::parse("[1, 2.5]", err).to_msgpack());
+    check("typed mixed array cbor", mixed.to_cbor() == Json::parse("[1, 2.5]", err).to_cbor());
+    check("typed mixed array not contiguous", mixed.number_span().empty() && mixed.int_span().empty());
+    check("typed int array", Json::parse("[1, 2]", err, typed).int_span().size == 2);
+    check("typed double array", Json::parse("[1.5, 2.5]", err, typed).number_span().size == 2);
+
+    if(failures){
+        return 1;
+    }
+    std::printf("binary_roundtrip_test passed\n");
+    return 0;
+}
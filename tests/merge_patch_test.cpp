@@ -0,0 +1,70 @@
+/*
+ * JSON Merge Patch（RFC 7396）的测试
+ * 包括补丁就是目标中的一棵子树的情况，合并时删掉的节点不能是正在遍历的补丁
+ */
+#include "../tiny_json.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using json11::Json;
+
+static int failures = 0;
+
+static Json parse(const char* in){
+    std::string err;
+    return Json::parse(in, err);
+}
+
+static void check(const char* what, const Json& actual, const Json& expected){
+    if(actual != expected){
+        std::printf("FAIL %s: got %s, expected %s\n", what, actual.dump().c_str(), expected.dump().c_str());
+        failures++;
+    }
+}
+
+int main(){
+    // RFC 7396附录A中的几个例子
+    {
+        Json target = parse("{\"a\":\"b\",\"c\":{\"d\":\"e\",\"f\":\"g\"}}");
+        target.merge_patch(parse("{\"a\":\"z\",\"c\":{\"f\":null}}"));
+        check("rfc example", target, parse("{\"a\":\"z\",\"c\":{\"d\":\"e\"}}"));
+    }
+    {
+        Json target = parse("{\"a\":[\"b\"]}");
+        target.merge_patch(parse("{\"a\":\"c\"}"));
+        check("array replaced", target, parse("{\"a\":\"c\"}"));
+    }
+    {
+        Json target = parse("[1,2]");
+        target.merge_patch(parse("{\"a\":\"b\",\"c\":null}"));
+        check("non-object target", target, parse("{\"a\":\"b\"}"));
+    }
+
+    // 多个补丁依次合并
+    {
+        Json target = parse("{\"a\":1,\"b\":{\"c\":2}}");
+        target.merge_patches({parse("{\"a\":null,\"b\":{\"d\":3}}"), parse("{\"a\":4,\"b\":{\"c\":null}}")});
+        check("merge_patches", target, parse("{\"a\":4,\"b\":{\"d\":3}}"));
+    }
+
+    // 补丁是目标自己的子树：删除"a"时补丁节点必须还活着
+    {
+        Json target = parse("{\"a\":{\"a\":null,\"b\":1}}");
+        target.merge_patch(target["a"]);
+        check("patch is a subtree of the target", target, parse("{\"b\":1}"));
+    }
+    {
+        Json target = parse("{\"a\":{\"a\":null,\"b\":{\"c\":1}},\"x\":2}");
+        std::vector<Json> patches{target["a"], target["a"]["b"]};
+        target.merge_patches(patches);
+        check("patches are subtrees of the target", target, parse("{\"b\":{\"c\":1},\"c\":1,\"x\":2}"));
+    }
+
+    if(failures){
+        return 1;
+    }
+    std::printf("merge_patch_test passed\n");
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * 右值构造不拷贝内容的测试
+ * 替换全局的operator new来数分配次数：移动进节点时只会多出节点本身，拷贝的话字符串和容器的缓冲区还要再分配一次
+ */
+#include "../tiny_json.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <map>
+#include <string>
+#include <vector>
+
+using json11::Json;
+
+static size_t allocations = 0;
+
+void* operator new(size_t size){
+    allocations++;
+    if(void* p = std::malloc(size ? size : 1)){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// std::pmr::new_delete_resource()总是调用带对齐参数的版本，容器的缓冲区从这里分配
+void* operator new(size_t size, std::align_val_t align){
+    allocations++;
+    const size_t a = static_cast<size_t>(align);
+    void* p = a <= alignof(std::max_align_t) ? std::malloc(size ? size : 1)
+                                             : std::aligned_alloc(a, (size + a - 1) / a * a);
+    if(p){
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+static int failures = 0;
+
+static void check(const char* what, size_t actual, size_t expected){
+    if(actual != expected){
+        std::printf("FAIL %s: %zu allocations, expected %zu\n", what, actual, expected);
+        failures++;
+    }
+}
+
+// 超过短字符串优化的长度，拷贝一定会分配
+static std::string long_string(int i){
+    return std::string(64, 'a' + i % 26);
+}
+
+// 解析嵌套n层的数组分配的次数
+static size_t parse_nested(int depth){
+    const std::string in = std::string(depth, '[') + std::string(depth, ']');
+    std::string err;
+    const size_t before = allocations;
+    Json json = Json::parse(in, err);
+    return allocations - before;
+}
+
+int main(){
+    const int n = 16;
+
+    {
+        std::string value = long_string(0);
+        const size_t before = allocations;
+        Json json(std::move(value));
+        check("Json(std::string&&)", allocations - before, 1);
+    }
+
+    {
+        Json::array items;
+        for(int i = 0; i < n; i++){
+            items.push_back(Json(long_string(i)));
+        }
+        const size_t before = allocations;
+        Json json(std::move(items));
+        check("Json(array&&)", allocations - before, 1);
+    }
+
+    {
+        Json::object items;
+        for(int i = 0; i < n; i++){
+            items.emplace(std::to_string(i), Json(long_string(i)));
+        }
+        const size_t before = allocations;
+        Json json(std::move(items));
+        check("Json(object&&)", allocations - before, 1);
+    }
+
+    {
+        // 每个字符串一个节点，再加上数组的缓冲区和数组节点
+        std::vector<std::string> items;
+        for(int i = 0; i < n; i++){
+            items.push_back(long_string(i));
+        }
+        const size_t before = allocations;
+        Json json(std::move(items));
+        check("Json(std::vector<std::string>&&)", allocations - before, n + 2);
+    }
+
+    {
+        // std::map的键是const，只能拷贝，所以用短键；值移动进字符串节点
+        std::map<std::string, std::string> items;
+        for(int i = 0; i < n; i++){
+            items.emplace(std::to_string(i), long_string(i));
+        }
+        const size_t before = allocations;
+        Json json(std::move(items));
+        check("Json(std::map<std::string, std::string>&&)", allocations - before, 2 * n + 1);
+    }
+
+    {
+        // 每一层的分配次数固定，逐层拷贝的话会随深度平方增长
+        const size_t shallow = parse_nested(50);
+        const size_t deep = parse_nested(100);
+        const size_t deeper = parse_nested(150);
+        check("parse nested arrays", deeper - deep, deep - shallow);
+    }
+
+    if(failures){
+        return 1;
+    }
+    std::printf("move_alloc_test passed\n");
+    return 0;
+}
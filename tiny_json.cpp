@@ -1,11 +1,37 @@
 #include "tiny_json.h"
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
+#include <exception>
+#include <future>
+#include <iterator>
 #include <limits>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
+#ifdef _WIN32
+    #include <io.h>
+    #include <fstream>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define JSON11_HAVE_SSE2 1
+    #include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
 namespace json11{
     // Json数据的最大深度
     static const int max_depth = 200;
@@ -13,7 +39,6 @@ namespace json11{
     using std::string;
     using std::vector;
     using std::map;
-    using std::make_shared;
     using std::move;
 
     /*
@@ -30,777 +55,4275 @@ namespace json11{
     };
 
 
+    class JsonShapedObject;
+
+    /*
+     * 按键的顺序遍历一个对象的成员，不是对象时没有成员
+     * 按形状保存的对象直接走形状中的键和对应的值，不会为了遍历而生成std::map
+     * 只在内部使用，遍历期间Json必须一直存在
+     */
+    struct ObjectMembers{
+        // 和std::map的value_type一样用first和second访问
+        struct Member{
+            const string& first;
+            const Json& second;
+        };
+
+        class iterator{
+        public:
+            struct Arrow{
+                Member member;
+                const Member* operator->() const { return &member; }
+            };
+
+            typedef std::forward_iterator_tag iterator_category;
+            typedef Member value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef Arrow pointer;
+            typedef Member reference;
+
+            Member operator*() const;
+            Arrow operator->() const { return Arrow{**this}; }
+            iterator& operator++();
+            bool operator==(const iterator& rhs) const { return m_shaped ? m_i == rhs.m_i : m_iter == rhs.m_iter; }
+            bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+
+        private:
+            friend struct ObjectMembers;
+            const JsonShapedObject* m_shaped = nullptr;
+            size_t m_i = 0;
+            Json::object::const_iterator m_iter;
+        };
+        typedef iterator const_iterator;
+
+        explicit ObjectMembers(const JsonValue* node);
+        explicit ObjectMembers(const Json& json) : ObjectMembers(json.m_kind == Json::HEAP ? json.m_ptr : nullptr) {}
+
+        size_t size() const;
+        bool empty() const { return size() == 0; }
+        iterator begin() const;
+        iterator end() const;
+        // 没有这个键时返回nullptr
+        const Json* find(const string& key) const;
+        // 复制成普通的对象时使用原来的memory_resource
+        std::pmr::memory_resource* resource() const;
+        // 两边是同一个对象节点，比较时可以直接跳过
+        bool same_node(const ObjectMembers& other) const { return m_node && m_node == other.m_node; }
+
+    private:
+        // 不是对象时为nullptr
+        const JsonValue* m_node = nullptr;
+        const JsonShapedObject* m_shaped = nullptr;
+        // 普通的对象遍历这个map，按形状保存时不使用
+        const Json::object* m_items = nullptr;
+    };
+
     /*
      * 序列化部分
      */
-    static void dump(NullStruct, string& out){
-        out += "null";
+
+    /*
+     * 序列化过程中的状态
+     * 不管是哪种DumpOptions::Style都使用这同一个序列化器
+     * 分隔符在构造时就确定好，序列化过程中不再判断风格
+     */
+    struct DumpState{
+        JsonSink& out;
+        const DumpOptions& options;
+        const bool pretty;
+        // 当前所在的嵌套层数，PRETTY模式下用于缩进
+        int depth = 0;
+        const char* array_sep;
+        size_t array_sep_len;
+        const char* key_sep;
+        size_t key_sep_len;
+
+        DumpState(JsonSink& out, const DumpOptions& options)
+            : out(out), options(options), pretty(options.style == DumpOptions::PRETTY) {
+            if(options.style == DumpOptions::DEFAULT){
+                array_sep = ", ";
+                array_sep_len = 2;
+            }
+            else{
+                array_sep = ",";
+                array_sep_len = 1;
+            }
+            if(options.style == DumpOptions::COMPACT){
+                key_sep = ":";
+                key_sep_len = 1;
+            }
+            else{
+                key_sep = ": ";
+                key_sep_len = 2;
+            }
+        }
+
+        void value(const Json& json);
+
+        // 只有PRETTY模式才会换行，并缩进到当前层级
+        void newline(){
+            if(!pretty){
+                return;
+            }
+            static const char spaces[] = "                                                                ";
+            out.put('\n');
+            size_t n = static_cast<size_t>(depth) * static_cast<size_t>(options.indent > 0 ? options.indent : 0);
+            while(n > 0){
+                const size_t chunk = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+                out.write(spaces, chunk);
+                n -= chunk;
+            }
+        }
+    };
+
+    static void dump(NullStruct, DumpState& state){
+        state.out.write("null", 4);
     }
 
-    static void dump(double value, string& out){
+    static void dump(double value, DumpState& state){
         // 检测value是否是一个有限数（既不是infinity（无穷大）或者NaN（非数））
         if(std::isfinite(value)){
             // 使用stringstream效率会更低
             char buf[32];
-            snprintf(buf, sizeof(buf), "%.17g", value);
-            out += buf;
+            const int n = snprintf(buf, sizeof(buf), "%.17g", value);
+            state.out.write(buf, static_cast<size_t>(n));
         }
         else{
             // Json是不是对于无穷大和非数也没法处理
-            out += "null";
+            state.out.write("null", 4);
         }
     }
 
-    static void dump(int value, string& out){
+    static void dump(int value, DumpState& state){
         char buf[32];
-        snprintf(buf, sizeof(buf), "%d", value);
-        out += buf;
+        const int n = snprintf(buf, sizeof(buf), "%d", value);
+        state.out.write(buf, static_cast<size_t>(n));
     }
 
-    static void dump(bool value, string& out){
-        out += value ? "true" : "false";
+    static void dump(bool value, DumpState& state){
+        if(value){
+            state.out.write("true", 4);
+        }
+        else{
+            state.out.write("false", 5);
+        }
     }
 
-    static void dump(const string& value, string& out){
-        out += '"';
-        for(size_t i = 0; i < value.size(); i++){
-            const char ch = value[i];
-            // ASCII码
-            if(ch == '\\'){
-                out += "\\\\";
-            }
-            else if(ch == '"'){
-                out += "\\\"";
-            }else if(ch == '\b'){
-                out += "\\b";
+    /*
+     * 字符串转义表
+     * 0表示该字节可以原样输出
+     * 'u'表示需要输出为\u00XX的形式
+     * 1表示可能是U+2028/U+2029的首字节，需要再看后两个字节
+     * 其余值就是反斜杠后面跟着的那个字符
+     */
+    static const char escape_table[256] = {
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+        'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+          0,   0, '"',   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,'\\',   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   1,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+          0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+    };
+
+    static const char hex_digits[] = "0123456789abcdef";
+
+    static inline unsigned count_trailing_zeros(unsigned mask){
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    /*
+     * 返回从p开始、不需要任何处理就能原样复制的字节数
+     * 有SSE2时一次检查16个字节，剩下的尾巴再查表
+     * ascii_only时所有>=0x80的字节也需要处理
+     */
+    template<bool ascii_only>
+    static inline size_t plain_run(const char* p, const char* end){
+        const char* begin = p;
+#ifdef JSON11_HAVE_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i lead_2028 = _mm_set1_epi8(static_cast<char>(0xe2));
+        const __m128i control = _mm_set1_epi8(0x1f);
+        while(end - p >= 16){
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            // max(v, 0x1f) == 0x1f 说明该字节 <= 0x1f
+            __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(v, control), control);
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, quote));
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, backslash));
+            unsigned mask;
+            if(ascii_only){
+                // 最高位为1的字节都要处理，movemask正好取的就是最高位
+                mask = static_cast<unsigned>(_mm_movemask_epi8(hit) | _mm_movemask_epi8(v));
             }
-            else if(ch == '\f'){
-                out += "\\f";
+            else{
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, lead_2028));
+                mask = static_cast<unsigned>(_mm_movemask_epi8(hit));
             }
-            else if(ch == '\n'){
-                out += "\\n";
+            if(mask != 0){
+                return static_cast<size_t>(p - begin) + count_trailing_zeros(mask);
             }
-            else if(ch == '\r'){
-                out += "\\r";
+            p += 16;
+        }
+#endif
+        while(p < end && escape_table[static_cast<uint8_t>(*p)] == 0
+              && (!ascii_only || static_cast<uint8_t>(*p) < 0x80)){
+            p++;
+        }
+        return static_cast<size_t>(p - begin);
+    }
+
+    /*
+     * 从p开始解码一个UTF-8字符，返回它占用的字节数
+     * 不合法的序列只消耗一个字节，码点记为U+FFFD
+     */
+    static size_t decode_utf8(const char* p, const char* end, long& codepoint){
+        const uint8_t lead = static_cast<uint8_t>(p[0]);
+        size_t len;
+        uint8_t lower = 0x80, upper = 0xbf;
+        if(lead >= 0xc2 && lead <= 0xdf){
+            len = 2;
+            codepoint = lead & 0x1f;
+        }
+        else if(lead >= 0xe0 && lead <= 0xef){
+            len = 3;
+            codepoint = lead & 0x0f;
+            // 排除过长编码和代理区
+            if(lead == 0xe0) lower = 0xa0;
+            if(lead == 0xed) upper = 0x9f;
+        }
+        else if(lead >= 0xf0 && lead <= 0xf4){
+            len = 4;
+            codepoint = lead & 0x07;
+            if(lead == 0xf0) lower = 0x90;
+            if(lead == 0xf4) upper = 0x8f;
+        }
+        else{
+            codepoint = 0xfffd;
+            return 1;
+        }
+        if(static_cast<size_t>(end - p) < len){
+            codepoint = 0xfffd;
+            return 1;
+        }
+        for(size_t k = 1; k < len; k++){
+            const uint8_t ch = static_cast<uint8_t>(p[k]);
+            if(ch < lower || ch > upper){
+                codepoint = 0xfffd;
+                return 1;
             }
-            else if('\t'){
-                out += "\\t";
+            lower = 0x80;
+            upper = 0xbf;
+            codepoint = (codepoint << 6) | (ch & 0x3f);
+        }
+        return len;
+    }
+
+    static inline void dump_u_escape(long unit, JsonSink& out){
+        const char buf[6] = {'\\', 'u', hex_digits[(unit >> 12) & 0xf], hex_digits[(unit >> 8) & 0xf],
+                             hex_digits[(unit >> 4) & 0xf], hex_digits[unit & 0xf]};
+        out.write(buf, sizeof(buf));
+    }
+
+    template<bool ascii_only>
+    static void dump_string(const char* data, size_t size, JsonSink& out){
+        out.put('"');
+        const char* p = data;
+        const char* const end = p + size;
+        while(p < end){
+            // 大段不需要转义的字节直接整体拷贝
+            const size_t run = plain_run<ascii_only>(p, end);
+            if(run > 0){
+                out.write(p, run);
+                p += run;
+                if(p == end){
+                    break;
+                }
             }
-            // 对unicode字符的支持
-            else if(static_cast<uint8_t>(ch) <= 0x1f){
-                char buf[8];
-                snprintf(buf, sizeof(buf), "\\u%04x", ch);
-                out += buf;
+
+            const uint8_t ch = static_cast<uint8_t>(*p);
+            const char esc = escape_table[ch];
+            if(ascii_only && ch >= 0x80){
+                // 码点超出BMP时按UTF-16拆成代理对
+                long codepoint;
+                p += decode_utf8(p, end, codepoint);
+                if(codepoint >= 0x10000){
+                    codepoint -= 0x10000;
+                    dump_u_escape(0xd800 + (codepoint >> 10), out);
+                    dump_u_escape(0xdc00 + (codepoint & 0x3ff), out);
+                }
+                else{
+                    dump_u_escape(codepoint, out);
+                }
+                continue;
             }
-            else if(static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i+1] == 0x80)
-            && static_cast<uint8_t>(value[i+2]) == 0xa8){
-                out += "\\u2028";
-                i += 2;
+            if(esc == 'u'){
+                const char buf[6] = {'\\', 'u', '0', '0', hex_digits[ch >> 4], hex_digits[ch & 0xf]};
+                out.write(buf, sizeof(buf));
             }
-            else if(static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i+1]) == 0x80
-                    && static_cast<uint8_t>(value[i+2]) == 0xa9){
-                out += "\\u2029";
-                i += 2;
+            else if(esc == 1){
+                // U+2028和U+2029在JavaScript中是换行符，需要转义
+                if(end - p >= 3 && static_cast<uint8_t>(p[1]) == 0x80
+                   && (static_cast<uint8_t>(p[2]) == 0xa8 || static_cast<uint8_t>(p[2]) == 0xa9)){
+                    out.write(static_cast<uint8_t>(p[2]) == 0xa8 ? "\\u2028" : "\\u2029", 6);
+                    p += 3;
+                    continue;
+                }
+                out.put(*p);
             }
             else{
-                out += ch;
+                const char buf[2] = {'\\', esc};
+                out.write(buf, sizeof(buf));
             }
+            p++;
+        }
+        out.put('"');
+    }
+
+    static void dump_string(const char* data, size_t size, DumpState& state){
+        if(state.options.ascii_only){
+            dump_string<true>(data, size, state.out);
+        }
+        else{
+            dump_string<false>(data, size, state.out);
         }
-        out += '"';
+    }
+
+    static void dump(std::string_view value, DumpState& state){
+        dump_string(value.data(), value.size(), state);
     }
 
     // 对Json::array进行处理
-    static void dump(const Json::array& values, string& out){
-        bool first = true;
-        out += "[";
-        for(const auto& value : values){
-            if(!first){
-                out += ", ";
+    static void dump(const Json::array& values, DumpState& state){
+        state.out.put('[');
+        if(!values.empty()){
+            state.depth++;
+            bool first = true;
+            for(const auto& value : values){
+                if(!first){
+                    state.out.write(state.array_sep, state.array_sep_len);
+                }
+                state.newline();
+                state.value(value);
+                first = false;
             }
-            value.dump(out);
-            first = false;
+            state.depth--;
+            state.newline();
         }
-        out += "]";
+        state.out.put(']');
     }
 
-    static void dump(const Json::object& values, string& out){
-        bool first = true;
-        out += "{";
-        for(const auto& kv : values){
-            if(!first){
-                out += ",";
+    // 连续保存的数字不需要逐个经过Json，格式与dump(Json::array)相同
+    template<class T>
+    static void dump(const std::pmr::vector<T>& values, DumpState& state){
+        state.out.put('[');
+        if(!values.empty()){
+            state.depth++;
+            for(size_t k = 0; k < values.size(); k++){
+                if(k > 0){
+                    state.out.write(state.array_sep, state.array_sep_len);
+                }
+                state.newline();
+                dump(values[k], state);
             }
-            dump(kv.first, out);
-            out += ": ";
-            kv.second.dump(out);
-            first = false;
+            state.depth--;
+            state.newline();
         }
-        out += "}";
+        state.out.put(']');
     }
 
-    void Json::dump(std::string &out) const {
-        m_ptr->dump(out);
+    // 写出对象中的一个成员，不是第一个时先写分隔符
+    static void dump_member(const string& key, const Json& value, bool first, DumpState& state){
+        if(!first){
+            state.out.put(',');
+        }
+        state.newline();
+        dump(key, state);
+        state.out.write(state.key_sep, state.key_sep_len);
+        state.value(value);
+    }
+
+    static void dump(const Json::object& values, DumpState& state){
+        state.out.put('{');
+        if(!values.empty()){
+            state.depth++;
+            bool first = true;
+            for(const auto& kv : values){
+                dump_member(kv.first, kv.second, first, state);
+                first = false;
+            }
+            state.depth--;
+            state.newline();
+        }
+        state.out.put('}');
     }
 
     /*
-     * 值包装器？？
-     * 装饰类？
+     * 序列化结果的缓存
+     * 每种非PRETTY的风格各占一个槽位，填充后不再改变
      */
-    template<Json::Type tag, typename T>
-    class Value : public JsonValue{
-    protected:
-        // 构造函数
-        explicit Value(const T& value)  : m_value(value) {}
-        /*
-         * 需要去看看move
-         */
-        explicit Value(T&& value)       : m_value(move(value)) {}
+    static std::atomic<size_t> dump_cache_total{0};
 
-        /*
-         * override可以帮助编译器检查
-         * 检查子类中的函数是否真正在重写基类中的函数
-         */
-        Json::Type type() const override{
-            return tag;
+    struct DumpCache{
+        std::atomic<const string*> slots[4] = {};
+
+        ~DumpCache(){
+            for(auto& slot : slots){
+                const string* cached = slot.load(std::memory_order_relaxed);
+                if(cached){
+                    dump_cache_total.fetch_sub(sizeof(string) + cached->capacity(), std::memory_order_relaxed);
+                    delete cached;
+                }
+            }
         }
 
-        /*
-         * 比较器
-         */
-        bool equals(const JsonValue* other) const override{
-            return m_value == static_cast<const Value<tag, T> *>(other)->m_value;
-//            return m_value == static_cast<const Value<tag, T> *>(other)->m_value;
+        static size_t slot_index(const DumpOptions& options){
+            return (options.style == DumpOptions::COMPACT ? 1 : 0) + (options.ascii_only ? 2 : 0);
         }
-        bool less(const JsonValue* other) const override{
-            return m_value < static_cast<const Value<tag, T> *>(other)->m_value;
+    };
+
+    void DumpState::value(const Json& json){
+        switch(json.m_kind){
+            case Json::INLINE_NULL:   json11::dump(NullStruct(), *this); return;
+            case Json::INLINE_BOOL:   json11::dump(json.m_bool, *this); return;
+            case Json::INLINE_INT:    json11::dump(json.m_int, *this); return;
+            case Json::INLINE_DOUBLE: json11::dump(json.m_double, *this); return;
+            case Json::HEAP:          break;
         }
-        const T m_value;
-        void dump(string& out) const override{
-            json11::dump(m_value, out);
+        const JsonValue* node = json.m_ptr;
+        DumpCache* cache = node->m_dump_cache.load(std::memory_order_acquire);
+        if(!cache || pretty || node->m_lent_children){
+            node->dump(*this);
+            return;
         }
-    };
 
-    /*
-     * 具体的JsonValue类
-     * 使用final表示这是一个最终类
-     * 不可再被继承
-     * （疑惑）：为什么接口声明为private，给谁用？
-     */
-    class JsonDouble final : public Value<Json::NUMBER, double>{
-        // 最原始的声明再JsonValue中
-        double number_value() const override { return m_value; }
-        int int_value() const override { return static_cast<int>(m_value); }
-        bool equals(const JsonValue* other) const override{ return m_value == other->number_value(); }
-        bool less(const JsonValue* other) const override  { return m_value <  other->number_value(); }
+        auto& slot = cache->slots[DumpCache::slot_index(options)];
+        const string* cached = slot.load(std::memory_order_acquire);
+        if(!cached){
+            // 先在本地序列化，再尝试发布；别的线程抢先发布了就用它的
+            string* fresh = new string;
+            {
+                StringSink sink(*fresh);
+                DumpState inner(sink, options);
+                node->dump(inner);
+            }
+            const string* expected = nullptr;
+            if(slot.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)){
+                dump_cache_total.fetch_add(sizeof(string) + fresh->capacity(), std::memory_order_relaxed);
+                cached = fresh;
+            }
+            else{
+                delete fresh;
+                cached = expected;
+            }
+        }
+        out.write(*cached);
+    }
 
-    public:
-        explicit JsonDouble(double value) : Value(value) {}
-    };
+    void Json::memoize_dump() const {
+        // 内联保存的标量序列化很快，不需要缓存
+        // 交出过子节点指针的节点随时可能被改掉，缓存会过期
+        if(m_kind != HEAP || m_ptr->m_lent_children || m_ptr->m_dump_cache.load(std::memory_order_acquire)){
+            return;
+        }
+        DumpCache* cache = new DumpCache;
+        DumpCache* expected = nullptr;
+        if(!m_ptr->m_dump_cache.compare_exchange_strong(expected, cache, std::memory_order_acq_rel)){
+            delete cache;
+        }
+    }
 
-    class JsonInt final : public Value<Json::NUMBER, int>{
-        double number_value() const override { return m_value; }
-        int int_value() const override { return m_value; }
-        bool equals(const JsonValue* other) const override{ return m_value == other->number_value(); }
-        bool less(const JsonValue* other) const override{ return m_value < other->number_value(); }
-    public:
-        explicit JsonInt(int value) : Value(value) {}
-    };
+    size_t Json::dump_cache_bytes() {
+        return dump_cache_total.load(std::memory_order_relaxed);
+    }
 
-    class JsonBoolean final : public Value<Json::BOOL, bool>{
-        bool bool_value() const override { return m_value; }
-    public:
-        explicit JsonBoolean(bool value) : Value(value) {}
-    };
+    /*
+     * 多线程序列化
+     * 把根节点的子节点分成若干段，每段在自己的线程里写入独立的string
+     * presize为true时每段先用CountingSink量出长度，只分配一次
+     * 最后按顺序拼接，段与段之间补上分隔符，因此输出与单线程完全一致
+     * dump_item(item, state)负责写出一个元素（对象的话包括键）
+     */
+    template<class Container, class DumpItem>
+    static void dump_parallel(const Container& items, char open, char close, JsonSink& out,
+                              const DumpOptions& options, DumpItem dump_item){
+        size_t chunks = options.threads;
+        if(chunks > items.size()){
+            chunks = items.size();
+        }
 
-    class JsonString final : public Value<Json::STRING, string>{
-        const string& string_value() const override{ return m_value; }
-    public:
-        explicit JsonString(const string& value) : Value(value) {}
-        explicit JsonString(string&& value)      : Value(move(value)) {}
-    };
+        auto dump_range = [&options, &dump_item](typename Container::const_iterator begin,
+                                                  typename Container::const_iterator end){
+            auto write_range = [&](JsonSink& sink){
+                DumpState state(sink, options);
+                state.depth = 1;
+                for(auto it = begin; it != end; ++it){
+                    if(it != begin){
+                        dump_item.separator(state);
+                    }
+                    state.newline();
+                    dump_item(*it, state);
+                }
+            };
+            string buffer;
+            {
+                StringSink sink(buffer);
+                if(options.presize){
+                    CountingSink counter;
+                    write_range(counter);
+                    sink.reserve(counter.size());
+                }
+                write_range(sink);
+            }
+            return buffer;
+        };
 
-    class JsonArray final : public Value<Json::ARRAY, Json::array>{
-        const Json::array& array_items() const override { return m_value; }
-        const Json& operator[](size_t i) const override;
-    public:
-        explicit JsonArray(const Json::array& value) : Value(value) {}
-        explicit JsonArray(Json::array&& value)      : Value(move(value)) {}
-    };
+        vector<std::future<string>> parts;
+        parts.reserve(chunks);
+        auto begin = items.begin();
+        for(size_t k = 0; k < chunks; k++){
+            // 前面几段多分一个，保证各段大小最多差一
+            const size_t count = items.size() / chunks + (k < items.size() % chunks ? 1 : 0);
+            auto end = std::next(begin, static_cast<std::ptrdiff_t>(count));
+            parts.push_back(std::async(std::launch::async, dump_range, begin, end));
+            begin = end;
+        }
 
-    class JsonObject final : public Value<Json::OBJECT, Json::object>{
-        const Json::object& object_items() const override{ return m_value; }
-        const Json& operator[](const string& key) const override;
-    public:
-        explicit JsonObject(const Json::object& value) : Value(value) {}
-        explicit JsonObject(const Json::object&& value) : Value(move(value)) {}
-    };
+        DumpState state(out, options);
+        out.put(open);
+        for(size_t k = 0; k < parts.size(); k++){
+            if(k > 0){
+                dump_item.separator(state);
+            }
+            out.write(parts[k].get());
+        }
+        state.newline();
+        out.put(close);
+    }
 
-//    class JsonNull final : public Value<Json::NUL, NullStruct>{
-//    public:
-//        JsonNull() : Value({}) {}
-//    };
-    class JsonNull final : public Value<Json::NUL, NullStruct> {
-    public:
-        JsonNull() : Value({}) {}
+    struct DumpArrayItem{
+        void separator(DumpState& state) const{
+            state.out.write(state.array_sep, state.array_sep_len);
+        }
+        void operator()(const Json& value, DumpState& state) const{
+            state.value(value);
+        }
     };
 
-    /*
-     * 静态全局变脸
-     * 静态初始化保证安全？
-     * 为了保证数据的一致性
-     */
-    struct Statics{
-        const std::shared_ptr<JsonValue> null = make_shared<JsonNull>();
-        const std::shared_ptr<JsonValue> t = make_shared<JsonBoolean>(true);
-        const std::shared_ptr<JsonValue> f = make_shared<JsonBoolean>(false);
-        const string empty_string;
-        const vector<Json> empty_vector;
-        const map<string, Json> empty_map;
-        Statics() {}
+    struct DumpObjectItem{
+        void separator(DumpState& state) const{
+            state.out.put(',');
+        }
+        void operator()(const ObjectMembers::Member& kv, DumpState& state) const{
+            dump(kv.first, state);
+            state.out.write(state.key_sep, state.key_sep_len);
+            state.value(kv.second);
+        }
     };
 
-    // 创建这么一个静态常量
-    static const Statics& statics(){
-        static const Statics s{};
-        return s;
+    void Json::dump(std::string &out, const DumpOptions& options) const {
+        StringSink sink(out);
+        // 要求预先量长度时容器只分配一次内存，多线程时每段各自量长度，这里就不再整体量一遍了
+        if(options.presize && (is_array() || is_object()) && options.threads <= 1){
+            sink.reserve(dump_size(options));
+        }
+        dump(sink, options);
     }
-    static const Json& static_null(){
-        // 这必须是分开的，因为Json()访问statics().null
-        // 这个函数用于创建一个空的Json值
-        static const Json json_null;
-        return json_null;
+
+    size_t Json::dump_size(const DumpOptions& options) const {
+        CountingSink sink;
+        dump(sink, options);
+        return sink.size();
     }
 
+    void Json::dump(JsonSink& out, const DumpOptions& options) const {
+        // 已经缓存过的节点直接拷贝缓存更快
+        if(options.threads > 1 && m_kind == HEAP && !m_ptr->m_dump_cache.load(std::memory_order_acquire)){
+            const Type t = type();
+            if(t == ARRAY && !array_items().empty() && array_items().size() >= options.parallel_min_items){
+                dump_parallel(array_items(), '[', ']', out, options, DumpArrayItem());
+                return;
+            }
+            if(t == OBJECT){
+                const ObjectMembers members(*this);
+                if(!members.empty() && members.size() >= options.parallel_min_items){
+                    dump_parallel(members, '{', '}', out, options, DumpObjectItem());
+                    return;
+                }
+            }
+        }
+        DumpState state(out, options);
+        state.value(*this);
+    }
 
     /*
-     * 访问器
+     * JsonWriter
+     * 与dump(const Json::array&)、dump(const Json::object&)的输出格式保持一致
      */
-    Json::Type Json::type() const { return m_ptr->type(); }
-    double Json::number_value() const { return m_ptr->number_value(); }
-    int Json::int_value() const { return m_ptr->int_value(); }
-    bool Json::bool_value() const { return m_ptr->bool_value(); }
-    const string& Json::string_value() const { return m_ptr->string_value(); }
-    const vector<Json>& Json::array_items() const { return m_ptr->array_items(); }
-    const map<string, Json>& Json::object_items() const { return m_ptr->object_items(); }
-    const Json& Json::operator[](size_t i) const { return (*m_ptr)[i]; }
-    const Json& Json::operator[](const std::string &key) const { return (*m_ptr)[key]; }
+    JsonWriter::JsonWriter(JsonSink& out, const DumpOptions& options)
+        : m_options(options), m_state(new DumpState(out, m_options)) {}
 
-    double JsonValue::number_value() const { return 0; }
-    int JsonValue::int_value() const { return 0; }
-    bool JsonValue::bool_value() const { return false; }
-    const string& JsonValue::string_value() const { return statics().empty_string; }
-    const vector<Json>& JsonValue::array_items() const { return statics().empty_vector; }
-    const map<string, Json>& JsonValue::object_items() const { return statics().empty_map; }
-    const Json& JsonValue::operator[](const std::string &key) const { return static_null(); }
-    const Json& JsonValue::operator[](size_t i) const { return static_null(); }
+    JsonWriter::JsonWriter(string& out, const DumpOptions& options)
+        : m_options(options), m_string_sink(new StringSink(out)),
+          m_state(new DumpState(*m_string_sink, m_options)) {}
 
-    const Json& JsonObject::operator[](const std::string &key) const {
-        auto iter = m_value.find(key);
-        return (iter == m_value.end() ) ? static_null() : iter->second;
+    JsonWriter::~JsonWriter() {
+        // 异常退出时容器本来就写不完，不再断言
+        assert((std::uncaught_exceptions() > 0 || (m_stack.empty() && !m_after_key))
+               && "JsonWriter: destroyed with unclosed containers");
+        flush();
     }
 
-    const Json& JsonArray::operator[](size_t i) const {
-        if(i >= m_value.size()){
-            return static_null();
-        }
-        else{
-            return m_value[i];
-        }
+    void JsonWriter::flush() {
+        m_state->out.flush();
     }
 
-    /*
-     * 比较器
-     */
-    bool Json::operator==(const Json& other) const {
-        if(m_ptr == other.m_ptr){
-            return false;
+    void JsonWriter::before_value() {
+        assert(!m_done && "JsonWriter: root value already written");
+        if(m_stack.empty()){
+            return;
         }
-        if(m_ptr->type() != other.m_ptr->type()){
-            return m_ptr->type() < other.m_ptr->type();
+        Frame& top = m_stack.back();
+        if(top.kind == '{'){
+            assert(m_after_key && "JsonWriter: object member needs key() first");
+            m_after_key = false;
+            return;
         }
-        return m_ptr->less(other.m_ptr.get());
+        if(!top.empty){
+            m_state->out.write(m_state->array_sep, m_state->array_sep_len);
+        }
+        m_state->newline();
+        top.empty = false;
     }
 
-    /*
-     * 解析
-     * C风格的字符串更适合打印错误消息
-     */
-    static inline string esc(char c){
-        char buf[12];
-        if(static_cast<uint8_t>(c) >= 0x20 && static_cast<uint8_t>(c)){
-            snprintf(buf, sizeof(buf), "'%c", c);
+    JsonWriter& JsonWriter::begin_object() {
+        before_value();
+        m_state->out.put('{');
+        m_state->depth++;
+        m_stack.push_back(Frame{'{', true});
+        return *this;
+    }
+
+    JsonWriter& JsonWriter::end_object() {
+        assert(!m_stack.empty() && m_stack.back().kind == '{' && "JsonWriter: end_object() without begin_object()");
+        assert(!m_after_key && "JsonWriter: key() without value");
+        const bool empty = m_stack.back().empty;
+        m_stack.pop_back();
+        m_state->depth--;
+        if(!empty){
+            m_state->newline();
         }
-        else{
-            snprintf(buf, sizeof(buf), "(%d)", c);
+        m_state->out.put('}');
+        m_done = m_stack.empty();
+        return *this;
+    }
+
+    JsonWriter& JsonWriter::begin_array() {
+        before_value();
+        m_state->out.put('[');
+        m_state->depth++;
+        m_stack.push_back(Frame{'[', true});
+        return *this;
+    }
+
+    JsonWriter& JsonWriter::end_array() {
+        assert(!m_stack.empty() && m_stack.back().kind == '[' && "JsonWriter: end_array() without begin_array()");
+        const bool empty = m_stack.back().empty;
+        m_stack.pop_back();
+        m_state->depth--;
+        if(!empty){
+            m_state->newline();
         }
-        return string(buf);
+        m_state->out.put(']');
+        m_done = m_stack.empty();
+        return *this;
     }
 
-    static inline bool in_range(long x, long lower, long upper){
-        return (x >= lower && x <= upper);
+    JsonWriter& JsonWriter::key(const string& name) {
+        return write_key(name.data(), name.size());
     }
 
-    namespace{
-        /*
-         * Json解析器
-         */
-        struct JsonParser final{
-            /*
-             * 状态信息
-             */
-            const string& str;
-            size_t i;
-            string& err;
-            bool failed;
-            const JsonParse strategy;
+    JsonWriter& JsonWriter::key(const char* name) {
+        return write_key(name, strlen(name));
+    }
 
-            /*
-             * 解析失败时的标记函数
-             * fail(msg, err_ret = Json())
-             */
-            Json fail(string&& msg){
-                return fail(move(msg), Json());
-            }
+    JsonWriter& JsonWriter::write_key(const char* name, size_t size) {
+        assert(!m_stack.empty() && m_stack.back().kind == '{' && "JsonWriter: key() outside of an object");
+        assert(!m_after_key && "JsonWriter: two keys in a row");
+        Frame& top = m_stack.back();
+        if(!top.empty){
+            m_state->out.put(',');
+        }
+        m_state->newline();
+        dump_string(name, size, *m_state);
+        m_state->out.write(m_state->key_sep, m_state->key_sep_len);
+        top.empty = false;
+        m_after_key = true;
+        return *this;
+    }
 
-            template<class T>
-            T fail(string&& msg, const T err_ret){
-                if(!failed){
-                    err = std::move(msg);
-                }
-                failed = true;
-                return err_ret;
-            }
+    JsonWriter& JsonWriter::value(std::nullptr_t) {
+        before_value();
+        dump(NullStruct{}, *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-            /*
-             * 将解析器向前移动
-             * 直到不是空白字符
-             * consume_whitespace
-             */
-            void consume_whitespace(){
-                while(str[i] == ' ' || str[i] == '\r' || str[i] == '\n'){
-                    i++;
-                }
-            }
+    JsonWriter& JsonWriter::value(double number) {
+        before_value();
+        dump(number, *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-            /*
-             * 对注释进行处理
-             * Json中的注释和C/C++中的一样
-             */
-            bool consume_comment(){
-                // 是否找到目标位置
-                bool comment_found = false;
-                if(str[i] == '/'){
-                    i++;
-                    if(i == str.size()){
-                        return fail("unexpected end of input after start of comment", false);
-                    }
-                    // 单行注释
-                    if(str[i] == '/'){
-                        i++;
-                        while(i < str.size() && str[i] != '\n'){
-                            i++;
-                        }
-                        comment_found = true;
-                    }
-                    // 多行注释
-                    else if(str[i] == '*'){
-                        i++;
-                        if(i > str.size() - 2){
-                            return fail("unexpected end of input multi-line comment", false);
-                        }
-                        while(!(str[i] == '*' && str[i+1] == '/')){
-                            i++;
-                            if(i > str.size() - 2){
-                                return fail("unexpected end of input inside mutil-line comment", false);
-                            }
-                        }
-                        i += 2;
-                        comment_found = true;
-                    }
-                    else{
-                        return fail("malformed comment", false);
-                    }
-                }
-                return comment_found;
-            }
+    JsonWriter& JsonWriter::value(int number) {
+        before_value();
+        dump(number, *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-            /*
-             * 移动解析器
-             * 直到其不是空白符也不是注释
-             */
-            void consume_garbage(){
-                consume_whitespace();
-                if(strategy == JsonParse::COMMENTS){
-                    bool comment_found = false;
-                    do{
-                        comment_found = consume_comment();
-                        if(failed){
-                            return;
-                        }
-                        consume_whitespace();
-                    }
-                    while(comment_found);
-                }
-            }
+    JsonWriter& JsonWriter::value(bool boolean) {
+        before_value();
+        dump(boolean, *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-            /*
-             * 返回下一个非空白字符
-             * 若是到达结尾都还还没找到，将会标记一个错误并返回0
-             */
-            char get_next_token(){
-                consume_garbage();
-                if(failed){
-                    return static_cast<char>(0);
-                }
-                if(i == str.size()){
-                    return fail("excepted end of input", static_cast<char>(0));
-                }
-                return str[i+1];
-            }
+    JsonWriter& JsonWriter::value(const string& str) {
+        before_value();
+        dump(str, *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-            /*
-             * 将unicode字符转换为utf-8，并添加到out中
-             */
-            void encode_utf8(long pt, string & out) {
-                if (pt < 0)
-                    return;
+    JsonWriter& JsonWriter::value(const char* str) {
+        before_value();
+        dump_string(str, strlen(str), *m_state);
+        m_done = m_stack.empty();
+        return *this;
+    }
 
-                if (pt < 0x80) {
-                    out += static_cast<char>(pt);
-                } else if (pt < 0x800) {
-                    out += static_cast<char>((pt >> 6) | 0xC0);
-                    out += static_cast<char>((pt & 0x3F) | 0x80);
-                } else if (pt < 0x10000) {
-                    out += static_cast<char>((pt >> 12) | 0xE0);
-                    out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
-                    out += static_cast<char>((pt & 0x3F) | 0x80);
-                } else {
-                    out += static_cast<char>((pt >> 18) | 0xF0);
-                    out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
-                    out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
-                    out += static_cast<char>((pt & 0x3F) | 0x80);
-                }
-            }
-
-            /*
-             * 解析字符串
-             * 从当前位置开始解析
-             *
-             * 这段代码对编码的认识程序要求很高
-             * 而我只熟悉ASCII，对unicode不懂
-             * 因此直接复制的大佬源码，请谅解
-             */
-            string parse_string() {
-                string out;
-                long last_escaped_codepoint = -1;
-                while (true) {
-                    if (i == str.size())
-                        return fail("unexpected end of input in string", "");
-
-                    char ch = str[i++];
-
-                    if (ch == '"') {
-                        encode_utf8(last_escaped_codepoint, out);
-                        return out;
-                    }
+    JsonWriter& JsonWriter::value(const Json& json) {
+        before_value();
+        m_state->value(json);
+        m_done = m_stack.empty();
+        return *this;
+    }
+
+    /*
+     * 各种JsonSink的实现
+     */
+    StringSink::StringSink(string& out) : m_out(out) {
+        m_cur = &m_out[0] + m_out.size();
+        m_end = m_cur;
+    }
 
-                    if (in_range(ch, 0, 0x1f))
-                        return fail("unescaped " + esc(ch) + " in string", "");
+    StringSink::~StringSink() {
+        flush();
+    }
 
-                    // The usual case: non-escaped characters
-                    if (ch != '\\') {
-                        encode_utf8(last_escaped_codepoint, out);
-                        last_escaped_codepoint = -1;
-                        out += ch;
-                        continue;
-                    }
+    void StringSink::flush() {
+        // 去掉扩容时多出来的尾部
+        m_out.resize(static_cast<size_t>(m_cur - &m_out[0]));
+        m_cur = &m_out[0] + m_out.size();
+        m_end = m_cur;
+    }
 
-                    // Handle escapes
-                    if (i == str.size())
-                        return fail("unexpected end of input in string", "");
+    void StringSink::reserve(size_t n) {
+        if(static_cast<size_t>(m_end - m_cur) >= n){
+            return;
+        }
+        const size_t used = static_cast<size_t>(m_cur - &m_out[0]);
+        m_out.resize(used + n);
+        m_cur = &m_out[0] + used;
+        m_end = &m_out[0] + used + n;
+    }
 
-                    ch = str[i++];
+    void StringSink::overflow(const char* data, size_t n) {
+        const size_t used = static_cast<size_t>(m_cur - &m_out[0]);
+        size_t capacity = m_out.size() * 2;
+        if(capacity < used + n){
+            capacity = used + n;
+        }
+        if(capacity < 64){
+            capacity = 64;
+        }
+        m_out.resize(capacity);
+        m_cur = &m_out[0] + used;
+        m_end = &m_out[0] + capacity;
+        memcpy(m_cur, data, n);
+        m_cur += n;
+    }
 
-                    if (ch == 'u') {
-                        // Extract 4-byte escape sequence
-                        string esc = str.substr(i, 4);
-                        // Explicitly check length of the substring. The following loop
-                        // relies on std::string returning the terminating NUL when
-                        // accessing str[length]. Checking here reduces brittleness.
-                        if (esc.length() < 4) {
-                            return fail("bad \\u escape: " + esc, "");
-                        }
-                        for (size_t j = 0; j < 4; j++) {
-                            if (!in_range(esc[j], 'a', 'f') && !in_range(esc[j], 'A', 'F')
-                                && !in_range(esc[j], '0', '9'))
-                                return fail("bad \\u escape: " + esc, "");
-                        }
+    CountingSink::CountingSink() {
+        m_cur = m_scratch;
+        m_end = m_scratch + sizeof(m_scratch);
+    }
 
-                        long codepoint = strtol(esc.data(), nullptr, 16);
-
-                        // JSON specifies that characters outside the BMP shall be encoded as a pair
-                        // of 4-hex-digit \u escapes encoding their surrogate pair components. Check
-                        // whether we're in the middle of such a beast: the previous codepoint was an
-                        // escaped lead (high) surrogate, and this is a trail (low) surrogate.
-                        if (in_range(last_escaped_codepoint, 0xD800, 0xDBFF)
-                            && in_range(codepoint, 0xDC00, 0xDFFF)) {
-                            // Reassemble the two surrogate pairs into one astral-plane character, per
-                            // the UTF-16 algorithm.
-                            encode_utf8((((last_escaped_codepoint - 0xD800) << 10)
-                                         | (codepoint - 0xDC00)) + 0x10000, out);
-                            last_escaped_codepoint = -1;
-                        } else {
-                            encode_utf8(last_escaped_codepoint, out);
-                            last_escaped_codepoint = codepoint;
-                        }
+    void CountingSink::overflow(const char*, size_t n) {
+        m_counted += static_cast<size_t>(m_cur - m_scratch) + n;
+        m_cur = m_scratch;
+    }
 
-                        i += 4;
-                        continue;
-                    }
+    FixedBufferSink::FixedBufferSink(char* buffer, size_t capacity) : m_begin(buffer) {
+        m_cur = buffer;
+        m_end = buffer + capacity;
+    }
 
-                    encode_utf8(last_escaped_codepoint, out);
-                    last_escaped_codepoint = -1;
+    void FixedBufferSink::overflow(const char* data, size_t n) {
+        // 能放下多少放多少，剩下的只记录长度
+        const size_t room = static_cast<size_t>(m_end - m_cur);
+        memcpy(m_cur, data, room);
+        m_cur += room;
+        m_dropped += n - room;
+    }
 
-                    if (ch == 'b') {
-                        out += '\b';
-                    } else if (ch == 'f') {
-                        out += '\f';
-                    } else if (ch == 'n') {
-                        out += '\n';
-                    } else if (ch == 'r') {
-                        out += '\r';
-                    } else if (ch == 't') {
-                        out += '\t';
-                    } else if (ch == '"' || ch == '\\' || ch == '/') {
-                        out += ch;
-                    } else {
-                        return fail("invalid escape character " + esc(ch), "");
-                    }
-                }
+    BufferedSink::BufferedSink(size_t chunk_size)
+        : m_chunk(new char[chunk_size]), m_chunk_size(chunk_size) {
+        m_cur = m_chunk.get();
+        m_end = m_cur + m_chunk_size;
+    }
+
+    void BufferedSink::flush() {
+        const size_t used = static_cast<size_t>(m_cur - m_chunk.get());
+        if(used > 0 && m_good){
+            m_good = write_out(m_chunk.get(), used);
+        }
+        m_cur = m_chunk.get();
+    }
+
+    void BufferedSink::overflow(const char* data, size_t n) {
+        flush();
+        // 比一整块还大的数据就不经过缓冲区了
+        if(n >= m_chunk_size){
+            if(m_good){
+                m_good = write_out(data, n);
             }
+            return;
+        }
+        memcpy(m_cur, data, n);
+        m_cur += n;
+    }
 
-            /*
-             * 对double类型进行解析
-             */
-            Json parse_number() {
-                size_t start_pos = i;
+    FileSink::FileSink(FILE* file, size_t chunk_size) : BufferedSink(chunk_size), m_file(file) {}
 
-                if (str[i] == '-')
-                    i++;
+    FileSink::~FileSink() {
+        flush();
+    }
 
-                // Integer part
-                if (str[i] == '0') {
-                    i++;
-                    if (in_range(str[i], '0', '9'))
-                        return fail("leading 0s not permitted in numbers");
-                } else if (in_range(str[i], '1', '9')) {
-                    i++;
-                    while (in_range(str[i], '0', '9'))
-                        i++;
-                } else {
-                    return fail("invalid " + esc(str[i]) + " in number");
-                }
+    bool FileSink::write_out(const char* data, size_t n) {
+        return fwrite(data, 1, n, m_file) == n;
+    }
 
-                if (str[i] != '.' && str[i] != 'e' && str[i] != 'E'
-                    && (i - start_pos) <= static_cast<size_t>(std::numeric_limits<int>::digits10)) {
-                    return std::atoi(str.c_str() + start_pos);
-                }
+    FdSink::FdSink(int fd, size_t chunk_size) : BufferedSink(chunk_size), m_fd(fd) {}
 
-                // Decimal part
-                if (str[i] == '.') {
-                    i++;
-                    if (!in_range(str[i], '0', '9'))
-                        return fail("at least one digit required in fractional part");
+    FdSink::~FdSink() {
+        flush();
+    }
 
-                    while (in_range(str[i], '0', '9'))
-                        i++;
+    bool FdSink::write_out(const char* data, size_t n) {
+        // write()可能只写出一部分，或者被信号打断，需要循环
+        while(n > 0){
+#ifdef _WIN32
+            const int chunk = n > 0x40000000 ? 0x40000000 : static_cast<int>(n);
+            const int written = _write(m_fd, data, static_cast<unsigned>(chunk));
+#else
+            const ssize_t written = ::write(m_fd, data, n);
+#endif
+            if(written < 0){
+                if(errno == EINTR){
+                    continue;
                 }
+                return false;
+            }
+            data += written;
+            n -= static_cast<size_t>(written);
+        }
+        return true;
+    }
 
-                // Exponent part
-                if (str[i] == 'e' || str[i] == 'E') {
-                    i++;
+    OStreamSink::OStreamSink(std::ostream& stream, size_t chunk_size) : BufferedSink(chunk_size), m_stream(stream) {}
 
-                    if (str[i] == '+' || str[i] == '-')
-                        i++;
+    OStreamSink::~OStreamSink() {
+        flush();
+    }
 
-                    if (!in_range(str[i], '0', '9'))
-                        return fail("at least one digit required in exponent");
+    bool OStreamSink::write_out(const char* data, size_t n) {
+        m_stream.write(data, static_cast<std::streamsize>(n));
+        return static_cast<bool>(m_stream);
+    }
 
-                    while (in_range(str[i], '0', '9'))
-                        i++;
-                }
+    /*
+     * 节点计数
+     */
+    struct NodeCounters{
+        std::atomic<size_t> allocated[6] = {};
+        std::atomic<size_t> live[6] = {};
+        std::atomic<size_t> bytes_live{0};
+    };
+
+    static NodeCounters node_counters;
+
+    static inline void count_node(Json::Type type, size_t bytes, bool created){
+#ifndef JSON11_DISABLE_STATS
+        if(created){
+            node_counters.allocated[type].fetch_add(1, std::memory_order_relaxed);
+            node_counters.live[type].fetch_add(1, std::memory_order_relaxed);
+            node_counters.bytes_live.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        else{
+            node_counters.live[type].fetch_sub(1, std::memory_order_relaxed);
+            node_counters.bytes_live.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+#else
+        (void)type;
+        (void)bytes;
+        (void)created;
+#endif
+    }
+
+    JsonStats Json::stats() {
+        JsonStats result;
+        for(int type = 0; type < 6; type++){
+            result.nodes_allocated[type] = node_counters.allocated[type].load(std::memory_order_relaxed);
+            result.nodes_live[type] = node_counters.live[type].load(std::memory_order_relaxed);
+        }
+        result.node_bytes_live = node_counters.bytes_live.load(std::memory_order_relaxed);
+        result.dump_cache_bytes = dump_cache_bytes();
+        return result;
+    }
+
+    // 短字符串保存在string对象内部，没有额外的缓冲区
+    template<class String>
+    static size_t string_memory(const String& value){
+        const char* data = value.data();
+        const char* self = reinterpret_cast<const char*>(&value);
+        if(data >= self && data < self + sizeof(String)){
+            return 0;
+        }
+        return value.capacity() + 1;
+    }
 
-                return std::strtod(str.c_str() + start_pos, nullptr);
+    /*
+     * string_value()要返回std::string，内容不是这样保存的节点在第一次调用时复制一份
+     * 多个线程同时复制时只保留先完成的那一份
+     */
+    static const string& lazy_string_copy(std::atomic<const string*>& copy, std::string_view value){
+        const string* current = copy.load(std::memory_order_acquire);
+        if(!current){
+            string* fresh = new string(value);
+            const string* expected = nullptr;
+            if(copy.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)){
+                current = fresh;
+            }
+            else{
+                delete fresh;
+                current = expected;
             }
+        }
+        return *current;
+    }
 
-            /* expect(str, res)
-             *
-             * Expect that 'str' starts at the character that was just read. If it does, advance
-             * the input and return res. If not, flag an error.
-             */
-            Json expect(const string &expected, Json res) {
-                assert(i != 0);
-                i--;
-                if (str.compare(i, expected.length(), expected) == 0) {
-                    i += expected.length();
-                    return res;
-                } else {
-                    return fail("parse error: expected " + expected + ", got " + str.substr(i, expected.length()));
-                }
+    /*
+     * 值包装器？？
+     * 装饰类？
+     */
+    template<Json::Type tag, typename T>
+    class Value : public JsonValue{
+    protected:
+        // 构造函数
+        explicit Value(const T& value)  : m_value(value) {}
+        /*
+         * 需要去看看move
+         */
+        explicit Value(T&& value)       : m_value(move(value)) {}
+
+        // 具体的节点类可能有新增成员，按make_node()记录的大小统计和归还
+        void destroy() const noexcept override{
+            count_node(tag, m_node_size, false);
+            std::pmr::memory_resource* resource = m_resource;
+            if(!resource){
+                delete this;
+                return;
             }
+            const size_t size = m_node_size;
+            Value* self = const_cast<Value*>(this);
+            self->~Value();
+            resource->deallocate(self, size, alignof(JsonValue));
+        }
 
-            /* parse_json()
-             *
-             * Parse a JSON object.
-             */
-            Json parse_json(int depth) {
-                if (depth > max_depth) {
-                    return fail("exceeded maximum nesting depth");
-                }
+        /*
+         * override可以帮助编译器检查
+         * 检查子类中的函数是否真正在重写基类中的函数
+         */
+        Json::Type type() const override{
+            return tag;
+        }
 
-                char ch = get_next_token();
-                if (failed)
-                    return Json();
+        // 不声明为const，否则右值构造时也只能拷贝
+        T m_value;
+        void dump(DumpState& state) const override{
+            json11::dump(m_value, state);
+        }
+    };
 
-                if (ch == '-' || (ch >= '0' && ch <= '9')) {
-                    i--;
-                    return parse_number();
-                }
+    /*
+     * 具体的JsonValue类
+     * 使用final表示这是一个最终类
+     * 不可再被继承
+     * （疑惑）：为什么接口声明为private，给谁用？
+     * null、bool和数字直接保存在Json中，没有对应的节点
+     */
+    class JsonString final : public Value<Json::STRING, string>{
+        const string& string_value() const override{ return m_value; }
+        size_t own_memory() const override { return sizeof(*this) + string_memory(m_value); }
+    public:
+        explicit JsonString(const string& value) : Value(value) {}
+        explicit JsonString(string&& value)      : Value(move(value)) {}
+    };
 
-                if (ch == 't')
-                    return expect("true", true);
+    class JsonArray final : public Value<Json::ARRAY, Json::array>{
+        const Json::array& array_items() const override { return m_value; }
+        const Json& operator[](size_t i) const override;
+        Json::array* mutable_array_items() override { return &m_value; }
+        size_t own_memory() const override { return sizeof(*this) + m_value.capacity() * sizeof(Json); }
+    public:
+        explicit JsonArray(const Json::array& value) : Value(value) {}
+        explicit JsonArray(Json::array&& value)      : Value(move(value)) {}
+    };
 
-                if (ch == 'f')
-                    return expect("false", false);
+    class JsonObject final : public Value<Json::OBJECT, Json::object>{
+        const Json::object& object_items() const override{ return m_value; }
+        const Json& operator[](const string& key) const override;
+        Json::object* mutable_object_items() override { return &m_value; }
+        size_t own_memory() const override {
+            // 红黑树的每个节点除了键值对，还有颜色和三个指针
+            size_t total = sizeof(*this);
+            for(const auto& item : m_value){
+                total += sizeof(Json::object::value_type) + 4 * sizeof(void*) + string_memory(item.first);
+            }
+            return total;
+        }
+    public:
+        explicit JsonObject(const Json::object& value) : Value(value) {}
+        explicit JsonObject(Json::object&& value)      : Value(move(value)) {}
+    };
 
-                if (ch == 'n')
-                    return expect("null", Json());
+    /*
+     * 借用输入缓冲区的字符串
+     * m_buffer是保存整个输入的字符串节点，m_value指向其中不需要反转义的一段
+     * string_value()要返回std::string，只能在第一次调用时复制出来
+     */
+    class JsonBorrowedString final : public Value<Json::STRING, std::string_view>{
+        friend struct MemoryCounter;
 
-                if (ch == '"')
-                    return parse_string();
+        const string& string_value() const override { return lazy_string_copy(m_copy, m_value); }
+        std::string_view string_view_value() const override { return m_value; }
+        // 输入缓冲区由整个文档共享，由MemoryCounter当作子节点计算
+        size_t own_memory() const override {
+            const string* copy = m_copy.load(std::memory_order_acquire);
+            return sizeof(*this) + (copy ? sizeof(string) + string_memory(*copy) : 0);
+        }
 
-                if (ch == '{') {
-                    map<string, Json> data;
-                    ch = get_next_token();
-                    if (ch == '}')
-                        return data;
+        Json m_buffer;
+        mutable std::atomic<const string*> m_copy{nullptr};
 
-                    while (1) {
-                        if (ch != '"')
-                            return fail("expected '\"' in object, got " + esc(ch));
+    public:
+        JsonBorrowedString(const Json& buffer, std::string_view view) : Value(view), m_buffer(buffer) {}
+        ~JsonBorrowedString() override { delete m_copy.load(std::memory_order_relaxed); }
+    };
 
-                        string key = parse_string();
-                        if (failed)
-                            return Json();
+    /*
+     * 内容从memory_resource分配的字符串，解析时指定了resource才会使用
+     * 只读取的话应使用string_view_value()，string_value()第一次调用时才复制出std::string
+     */
+    class JsonPmrString final : public Value<Json::STRING, std::pmr::string>{
+        const string& string_value() const override { return lazy_string_copy(m_copy, m_value); }
+        std::string_view string_view_value() const override { return m_value; }
+        size_t own_memory() const override {
+            const string* copy = m_copy.load(std::memory_order_acquire);
+            return sizeof(*this) + string_memory(m_value) + (copy ? sizeof(string) + string_memory(*copy) : 0);
+        }
 
-                        ch = get_next_token();
-                        if (ch != ':')
-                            return fail("expected ':' in object, got " + esc(ch));
+        mutable std::atomic<const string*> m_copy{nullptr};
 
-                        data[std::move(key)] = parse_json(depth + 1);
-                        if (failed)
-                            return Json();
+    public:
+        explicit JsonPmrString(std::pmr::string&& value) : Value(move(value)) {}
+        ~JsonPmrString() override { delete m_copy.load(std::memory_order_relaxed); }
+    };
 
-                        ch = get_next_token();
-                        if (ch == '}')
-                            break;
-                        if (ch != ',')
-                            return fail("expected ',' in object, got " + esc(ch));
+    /*
+     * 延迟转换的数字
+     * m_value保存解析时的原文，和节点一样从解析时的memory_resource分配，第一次读取时才转换并缓存
+     * 多个线程同时转换得到的是同一个值，所以不需要加锁
+     */
+    class JsonLazyNumber final : public Value<Json::NUMBER, std::pmr::string>{
+        double number_value() const override {
+            if(!m_converted.load(std::memory_order_acquire)){
+                m_number.store(std::strtod(m_value.c_str(), nullptr), std::memory_order_relaxed);
+                m_converted.store(true, std::memory_order_release);
+            }
+            return m_number.load(std::memory_order_relaxed);
+        }
+        int int_value() const override { return static_cast<int>(number_value()); }
+        void dump(DumpState& state) const override { state.out.write(m_value.data(), m_value.size()); }
+        size_t own_memory() const override { return sizeof(*this) + string_memory(m_value); }
 
-                        ch = get_next_token();
-                    }
-                    return data;
-                }
+        mutable std::atomic<double> m_number{0};
+        mutable std::atomic<bool> m_converted{false};
 
-                if (ch == '[') {
-                    vector<Json> data;
-                    ch = get_next_token();
-                    if (ch == ']')
-                        return data;
+    public:
+        JsonLazyNumber(std::string_view text, const std::pmr::polymorphic_allocator<char>& allocator)
+            : Value(std::pmr::string(text, allocator)) {}
 
-                    while (1) {
-                        i--;
-                        data.push_back(parse_json(depth + 1));
-                        if (failed)
-                            return Json();
+        std::string_view text() const { return m_value; }
+    };
 
-                        ch = get_next_token();
-                        if (ch == ']')
-                            break;
-                        if (ch != ',')
-                            return fail("expected ',' in list, got " + esc(ch));
+    /*
+     * 对象的形状：一组有序的键
+     * 解析时键完全相同的对象共享同一个形状，创建之后不再修改，可以在线程之间共享
+     * 形状本身和两张表从解析时的memory_resource分配
+     */
+    struct JsonShape{
+        explicit JsonShape(std::pmr::memory_resource* resource) : keys(resource), index(resource) {}
 
-                        ch = get_next_token();
-                        (void)ch;
-                    }
-                    return data;
-                }
+        std::pmr::vector<string> keys;
+        // 键到下标的索引，string_view指向keys中的字符串
+        std::pmr::unordered_map<std::string_view, size_t> index;
 
-                return fail("expected value, got " + esc(ch));
+        // 形状和两张表占用的字节数，哈希表的每个元素按一个节点加一个桶估算
+        size_t memory() const {
+            size_t total = sizeof(JsonShape) + keys.capacity() * sizeof(string)
+                           + index.bucket_count() * sizeof(void*)
+                           + index.size() * (sizeof(std::pair<const std::string_view, size_t>) + sizeof(void*));
+            for(const string& key : keys){
+                total += string_memory(key);
             }
-            /******************* 复制部分结束 ********************/
-        };
-    } // namespace none
-
+            return total;
+        }
+    };
 
-    Json Json::parse(const string& in, string& err, JsonParse strategy){
-        JsonParser parser {in, 0, err, false, strategy};
-        Json result = parser.parse_json(0);
+    /*
+     * 按形状保存的对象
+     * m_value[i]是键m_shape->keys[i]对应的值
+     * object_items()需要返回std::map，只能在第一次调用时生成
+     */
+    class JsonShapedObject final : public Value<Json::OBJECT, Json::array>{
+        friend struct MemoryCounter;
+        friend struct ObjectMembers;
 
-        // 检查是否有不必要的“垃圾”跟随在尾部
-        parser.consume_garbage();
-        if(parser.failed){
-            return Json();
+        const Json::object& object_items() const override {
+            const Json::object* items = m_items.load(std::memory_order_acquire);
+            if(!items){
+                Json::object* fresh = new Json::object(m_value.get_allocator());
+                for(size_t k = 0; k < m_value.size(); k++){
+                    fresh->emplace_hint(fresh->end(), m_shape->keys[k], m_value[k]);
+                }
+                const Json::object* expected = nullptr;
+                if(m_items.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)){
+                    items = fresh;
+                }
+                else{
+                    delete fresh;
+                    items = expected;
+                }
+            }
+            return *items;
         }
-        if(parser.i != in.size()){
-            return parser.fail("unexpected trailing" + esc(in[parser.i]));
+
+        const Json& operator[](const string& key) const override;
+
+        // 形状相同时只需要比较值
+        bool equals(const JsonValue* other) const override {
+            const JsonShapedObject* shaped = dynamic_cast<const JsonShapedObject*>(other);
+            if(shaped && shaped->m_shape == m_shape){
+                return m_value == shaped->m_value;
+            }
+            return JsonValue::equals(other);
         }
-        return result;
-    }
+        // 不需要生成std::map
+        size_t compute_hash() const override;
 
-    /*
-     * 记录在.h文件中
-     */
-    vector<Json> Json::parse_multi(const string& in,
-                                   std::string::size_type& parser_stop_pos,
-                                   string& err,
-                                   JsonParse strategy){
-        JsonParser parser {in, 0, err, false, strategy};
-        parser_stop_pos = 0;
-        vector<Json> json_vec;
-        while(parser.i != in.size() && !parser.failed){
-            json_vec.push_back(parser.parse_json(0));
-            if(parser.failed){
-                break;
+        void dump(DumpState& state) const override {
+            state.out.put('{');
+            state.depth++;
+            for(size_t k = 0; k < m_value.size(); k++){
+                dump_member(m_shape->keys[k], m_value[k], k == 0, state);
             }
+            state.depth--;
+            state.newline();
+            state.out.put('}');
+        }
 
-            // 检查其它对象
-            parser.consume_garbage();
-            if(parser.failed){
-                break;
+        // 形状由很多对象共享，由MemoryCounter计算
+        size_t own_memory() const override {
+            size_t total = sizeof(*this) + m_value.capacity() * sizeof(Json);
+            if(const Json::object* items = m_items.load(std::memory_order_acquire)){
+                total += sizeof(Json::object);
+                for(const auto& item : *items){
+                    total += sizeof(Json::object::value_type) + 4 * sizeof(void*) + string_memory(item.first);
+                }
             }
-            parser_stop_pos = parser.i;
+            return total;
         }
-        return json_vec;
-    }
+
+        std::shared_ptr<const JsonShape> m_shape;
+        mutable std::atomic<const Json::object*> m_items{nullptr};
+
+    public:
+        JsonShapedObject(std::shared_ptr<const JsonShape> shape, Json::array&& values)
+            : Value(move(values)), m_shape(move(shape)) {}
+        ~JsonShapedObject() override { delete m_items.load(std::memory_order_relaxed); }
+    };
 
     /*
-     * 对Json数据的结构进行检查
+     * 连续保存的数字数组
+     * array_items()需要返回Json::array，只能在第一次调用时生成，operator[]也要通过它返回引用
      */
-    bool Json::has_shape(const shape & types, string & err) const {
-        if (!is_object()) {
-            err = "expected JSON object, got " + dump();
-            return false;
+    template<class T>
+    class JsonNumberArray final : public Value<Json::ARRAY, std::pmr::vector<T>>{
+        using Base = Value<Json::ARRAY, std::pmr::vector<T>>;
+        using Base::m_value;
+
+        const Json::array& array_items() const override {
+            const Json::array* items = m_items.load(std::memory_order_acquire);
+            if(!items){
+                Json::array* fresh = new Json::array(m_value.begin(), m_value.end(), m_value.get_allocator());
+                const Json::array* expected = nullptr;
+                if(m_items.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel)){
+                    items = fresh;
+                }
+                else{
+                    delete fresh;
+                    items = expected;
+                }
+            }
+            return *items;
         }
 
-        const auto& obj_items = object_items();
+        const Json& operator[](size_t i) const override;
+        // 直接从缓冲区计算，不生成Json::array
+        size_t compute_hash() const override;
+
+        // 同样保存方式的数组直接比较缓冲区
+        bool equals(const JsonValue* other) const override {
+            if(const JsonNumberArray* numbers = dynamic_cast<const JsonNumberArray*>(other)){
+                return m_value == numbers->m_value;
+            }
+            return JsonValue::equals(other);
+        }
+        bool less(const JsonValue* other) const override {
+            if(const JsonNumberArray* numbers = dynamic_cast<const JsonNumberArray*>(other)){
+                return m_value < numbers->m_value;
+            }
+            return JsonValue::less(other);
+        }
+
+        size_t own_memory() const override {
+            size_t total = sizeof(*this) + m_value.capacity() * sizeof(T);
+            if(const Json::array* items = m_items.load(std::memory_order_acquire)){
+                total += sizeof(Json::array) + items->capacity() * sizeof(Json);
+            }
+            return total;
+        }
+
+        mutable std::atomic<const Json::array*> m_items{nullptr};
+
+    public:
+        explicit JsonNumberArray(std::pmr::vector<T>&& values) : Base(move(values)) {}
+        ~JsonNumberArray() override { delete m_items.load(std::memory_order_relaxed); }
+
+        NumberSpan<T> span() const { return {m_value.data(), m_value.size()}; }
+    };
+
+    /*
+     * 解析时使用的形状表
+     * 相邻的对象通常形状相同，所以先和上一次的形状比较
+     */
+    struct ShapeTable{
+        // 形状太多说明数据不是表格型的，之后的对象不再共享形状
+        static const size_t max_shapes = 4096;
+
+        std::unordered_map<string, std::shared_ptr<const JsonShape>> shapes;
+        std::shared_ptr<const JsonShape> last;
+
+        // members已经按键排序并且没有重复的键，找不到也不能再新建时返回nullptr
+        template<class Members>
+        std::shared_ptr<const JsonShape> find(const Members& members, std::pmr::memory_resource* resource){
+            if(last && last->keys.size() == members.size()
+               && std::equal(members.begin(), members.end(), last->keys.begin(),
+                             [](const typename Members::value_type& member, const string& key){
+                                 return member.first == key;
+                             })){
+                return last;
+            }
+            // 带长度前缀拼接，键中包含任何字符都不会混淆
+            string signature;
+            for(const auto& member : members){
+                signature += std::to_string(member.first.size());
+                signature += ':';
+                signature += member.first;
+            }
+            auto iter = shapes.find(signature);
+            if(iter == shapes.end()){
+                if(shapes.size() >= max_shapes){
+                    return nullptr;
+                }
+                auto shape = std::allocate_shared<JsonShape>(std::pmr::polymorphic_allocator<JsonShape>(resource), resource);
+                shape->keys.reserve(members.size());
+                for(const auto& member : members){
+                    shape->keys.push_back(member.first);
+                }
+                for(size_t k = 0; k < shape->keys.size(); k++){
+                    shape->index.emplace(shape->keys[k], k);
+                }
+                iter = shapes.emplace(move(signature), move(shape)).first;
+            }
+            last = iter->second;
+            return last;
+        }
+    };
+
+    /*
+     * 静态全局变脸
+     * 静态初始化保证安全？
+     * 为了保证数据的一致性
+     */
+    struct Statics{
+        const string empty_string;
+        const Json::array empty_vector;
+        const Json::object empty_map;
+        Statics() {}
+    };
+
+    // 创建这么一个静态常量
+    static const Statics& statics(){
+        static const Statics s{};
+        return s;
+    }
+    static const Json& static_null(){
+        // 这个函数用于创建一个空的Json值
+        static const Json json_null;
+        return json_null;
+    }
+
+    /*
+     * ObjectMembers
+     * 形状中的键已经按std::map的顺序排好了，两种对象遍历出来的顺序相同
+     */
+    ObjectMembers::ObjectMembers(const JsonValue* node) {
+        if(node && node->type() == Json::OBJECT){
+            m_node = node;
+            m_shaped = dynamic_cast<const JsonShapedObject*>(node);
+        }
+        if(!m_shaped){
+            m_items = m_node ? &m_node->object_items() : &statics().empty_map;
+        }
+    }
+
+    size_t ObjectMembers::size() const {
+        return m_shaped ? m_shaped->m_value.size() : m_items->size();
+    }
+
+    ObjectMembers::iterator ObjectMembers::begin() const {
+        iterator iter;
+        iter.m_shaped = m_shaped;
+        if(!m_shaped){
+            iter.m_iter = m_items->begin();
+        }
+        return iter;
+    }
+
+    ObjectMembers::iterator ObjectMembers::end() const {
+        iterator iter;
+        iter.m_shaped = m_shaped;
+        if(m_shaped){
+            iter.m_i = m_shaped->m_value.size();
+        }
+        else{
+            iter.m_iter = m_items->end();
+        }
+        return iter;
+    }
+
+    const Json* ObjectMembers::find(const string& key) const {
+        if(m_shaped){
+            auto iter = m_shaped->m_shape->index.find(key);
+            return iter == m_shaped->m_shape->index.end() ? nullptr : &m_shaped->m_value[iter->second];
+        }
+        auto iter = m_items->find(key);
+        return iter == m_items->end() ? nullptr : &iter->second;
+    }
+
+    std::pmr::memory_resource* ObjectMembers::resource() const {
+        return m_shaped ? m_shaped->m_value.get_allocator().resource() : m_items->get_allocator().resource();
+    }
+
+    ObjectMembers::Member ObjectMembers::iterator::operator*() const {
+        if(m_shaped){
+            return Member{m_shaped->m_shape->keys[m_i], m_shaped->m_value[m_i]};
+        }
+        return Member{m_iter->first, m_iter->second};
+    }
+
+    ObjectMembers::iterator& ObjectMembers::iterator::operator++() {
+        if(m_shaped){
+            m_i++;
+        }
+        else{
+            ++m_iter;
+        }
+        return *this;
+    }
+
+
+    /*
+     * 新建节点
+     * 节点跟随容器使用同一个memory_resource，全局的new/delete则直接用new
+     */
+    template<class Node, class... Args>
+    Json Json::make_node(std::pmr::memory_resource* resource, Args&&... args){
+        static_assert(alignof(Node) <= alignof(JsonValue), "node needs stricter alignment");
+        static_assert(sizeof(Node) <= UINT16_MAX, "node too large");
+        if(!resource || resource == std::pmr::new_delete_resource()){
+            Node* node = new Node(std::forward<Args>(args)...);
+            static_cast<JsonValue*>(node)->m_node_size = sizeof(Node);
+            count_node(static_cast<JsonValue*>(node)->type(), sizeof(Node), true);
+            return Json(node);
+        }
+        void* memory = resource->allocate(sizeof(Node), alignof(JsonValue));
+        Node* node;
+        try{
+            node = new(memory) Node(std::forward<Args>(args)...);
+        }
+        catch(...){
+            resource->deallocate(memory, sizeof(Node), alignof(JsonValue));
+            throw;
+        }
+        static_cast<JsonValue*>(node)->m_resource = resource;
+        static_cast<JsonValue*>(node)->m_node_size = sizeof(Node);
+        count_node(static_cast<JsonValue*>(node)->type(), sizeof(Node), true);
+        return Json(node);
+    }
+
+    /*
+     * 构造函数
+     */
+    Json::Json(const string& value)         : Json(make_node<JsonString>(nullptr, value)) {}
+    Json::Json(string&& value)              : Json(make_node<JsonString>(nullptr, move(value))) {}
+    Json::Json(const char* value)           : Json(make_node<JsonString>(nullptr, value)) {}
+    Json::Json(const Json::array& values)   : Json(make_node<JsonArray>(nullptr, values)) {}
+    Json::Json(Json::array&& values)        : Json(make_node<JsonArray>(values.get_allocator().resource(), move(values))) {}
+    Json::Json(const Json::object& values)  : Json(make_node<JsonObject>(nullptr, values)) {}
+    Json::Json(Json::object&& values)       : Json(make_node<JsonObject>(values.get_allocator().resource(), move(values))) {}
+
+    Json::Json(JsonValue* value) noexcept : m_ptr(value), m_kind(HEAP) {
+        m_ptr->retain();
+    }
+
+    /*
+     * 引用计数的方式
+     * SingleThreadScope可以嵌套，这里记录当前线程进入了几层
+     */
+    static thread_local int single_thread_depth = 0;
+
+    Json::SingleThreadScope::SingleThreadScope() {
+        single_thread_depth++;
+    }
+
+    Json::SingleThreadScope::~SingleThreadScope() {
+        single_thread_depth--;
+    }
+
+#ifdef JSON11_NONATOMIC_REFCOUNT
+    JsonValue::JsonValue() : m_ref_mode(REF_LOCAL) {}
+#else
+    JsonValue::JsonValue() : m_ref_mode(single_thread_depth > 0 ? REF_LOCAL : REF_ATOMIC) {}
+#endif
+
+    /*
+     * 访问器
+     */
+    double Json::number_value() const {
+        switch(m_kind){
+            case INLINE_INT:    return m_int;
+            case INLINE_DOUBLE: return m_double;
+            case HEAP:          return m_ptr->number_value();
+            default:            return 0;
+        }
+    }
+    int Json::int_value() const {
+        switch(m_kind){
+            case INLINE_INT:    return m_int;
+            case INLINE_DOUBLE: return static_cast<int>(m_double);
+            case HEAP:          return m_ptr->int_value();
+            default:            return 0;
+        }
+    }
+    bool Json::bool_value() const {
+        switch(m_kind){
+            case INLINE_BOOL:   return m_bool;
+            case HEAP:          return m_ptr->bool_value();
+            default:            return false;
+        }
+    }
+    bool Json::stores_integer() const {
+        return m_kind == INLINE_INT || (m_kind == HEAP && m_ptr->is_integer());
+    }
+    const string& Json::string_value() const {
+        return m_kind == HEAP ? m_ptr->string_value() : statics().empty_string;
+    }
+    std::string_view Json::string_view_value() const {
+        return m_kind == HEAP ? m_ptr->string_view_value() : std::string_view();
+    }
+    const Json::array& Json::array_items() const {
+        return m_kind == HEAP ? m_ptr->array_items() : statics().empty_vector;
+    }
+    const Json::object& Json::object_items() const {
+        return m_kind == HEAP ? m_ptr->object_items() : statics().empty_map;
+    }
+    NumberSpan<double> Json::number_span() const {
+        const auto* numbers = m_kind == HEAP ? dynamic_cast<const JsonNumberArray<double>*>(m_ptr) : nullptr;
+        return numbers ? numbers->span() : NumberSpan<double>();
+    }
+    NumberSpan<int> Json::int_span() const {
+        const auto* numbers = m_kind == HEAP ? dynamic_cast<const JsonNumberArray<int>*>(m_ptr) : nullptr;
+        return numbers ? numbers->span() : NumberSpan<int>();
+    }
+    const Json& Json::operator[](size_t i) const {
+        return m_kind == HEAP ? (*m_ptr)[i] : static_null();
+    }
+    const Json& Json::operator[](const std::string &key) const {
+        return m_kind == HEAP ? (*m_ptr)[key] : static_null();
+    }
+
+    /*
+     * 写时复制
+     * 引用计数为1说明没有别的Json能看到这个节点，可以直接修改
+     */
+    Json::object* Json::mutable_object() {
+        if(is_null()){
+            *this = Json(object());
+        }
+        else if(type() != OBJECT){
+            return nullptr;
+        }
+        Json::object* items = m_ptr->mutable_object_items();
+        if(!items || m_ptr->m_refs.load(std::memory_order_acquire) > 1){
+            // 复制出来的节点仍然使用原来的memory_resource，按形状保存的对象直接从形状复制
+            const ObjectMembers members(*this);
+            Json::object copy(Json::object::allocator_type(members.resource()));
+            for(const auto& member : members){
+                copy.emplace_hint(copy.end(), member.first, member.second);
+            }
+            *this = make_node<JsonObject>(members.resource(), move(copy));
+            items = m_ptr->mutable_object_items();
+        }
+        delete m_ptr->m_dump_cache.exchange(nullptr, std::memory_order_acq_rel);
+        m_ptr->m_hash.store(0, std::memory_order_relaxed);
+        return items;
+    }
+
+    Json::array* Json::mutable_array() {
+        if(is_null()){
+            *this = Json(array());
+        }
+        else if(type() != ARRAY){
+            return nullptr;
+        }
+        Json::array* items = m_ptr->mutable_array_items();
+        if(!items || m_ptr->m_refs.load(std::memory_order_acquire) > 1){
+            const Json::array::allocator_type allocator = array_items().get_allocator();
+            *this = make_node<JsonArray>(allocator.resource(), Json::array(array_items(), allocator));
+            items = m_ptr->mutable_array_items();
+        }
+        delete m_ptr->m_dump_cache.exchange(nullptr, std::memory_order_acq_rel);
+        m_ptr->m_hash.store(0, std::memory_order_relaxed);
+        return items;
+    }
+
+    Json* Json::at_mut(const std::string& key) {
+        Json* child = child_mut(key);
+        if(child){
+            m_ptr->m_lent_children = true;
+        }
+        return child;
+    }
+
+    Json* Json::at_mut(size_t i) {
+        Json* child = child_mut(i);
+        if(child){
+            m_ptr->m_lent_children = true;
+        }
+        return child;
+    }
+
+    // 交出过指针的节点一定是at_mut()之前由mutable_object()或mutable_array()分离出来的JsonObject或JsonArray
+    Json Json::clone_lent() const {
+        if(type() == OBJECT){
+            const object& items = object_items();
+            return make_node<JsonObject>(items.get_allocator().resource(), object(items, items.get_allocator()));
+        }
+        const array& items = array_items();
+        return make_node<JsonArray>(items.get_allocator().resource(), array(items, items.get_allocator()));
+    }
+
+    Json* Json::child_mut(const std::string& key) {
+        object* items = mutable_object();
+        return items ? &(*items)[key] : nullptr;
+    }
+
+    Json* Json::child_mut(size_t i) {
+        // 先检查下标，越界时不需要分离
+        if(!is_null() && i > array_items().size()){
+            return nullptr;
+        }
+        array* items = mutable_array();
+        if(!items || i > items->size()){
+            return nullptr;
+        }
+        if(i == items->size()){
+            items->emplace_back();
+        }
+        return &(*items)[i];
+    }
+
+    bool Json::set(const std::string& key, Json value) {
+        object* items = mutable_object();
+        if(!items){
+            return false;
+        }
+        (*items)[key] = move(value);
+        return true;
+    }
+
+    bool Json::erase(const std::string& key) {
+        // 先查找，没有这个键时不需要分离
+        if(!ObjectMembers(*this).find(key)){
+            return false;
+        }
+        mutable_object()->erase(key);
+        return true;
+    }
+
+    bool Json::erase(size_t i) {
+        if(i >= array_items().size()){
+            return false;
+        }
+        array* items = mutable_array();
+        items->erase(items->begin() + i);
+        return true;
+    }
+
+    bool Json::push_back(Json value) {
+        array* items = mutable_array();
+        if(!items){
+            return false;
+        }
+        items->push_back(move(value));
+        return true;
+    }
+
+    bool Json::insert(size_t pos, Json value) {
+        array* items = mutable_array();
+        if(!items){
+            return false;
+        }
+        items->insert(items->begin() + std::min(pos, items->size()), move(value));
+        return true;
+    }
+
+    JsonValue::~JsonValue() {
+        delete m_dump_cache.load(std::memory_order_relaxed);
+    }
+
+    double JsonValue::number_value() const { return 0; }
+    int JsonValue::int_value() const { return 0; }
+    bool JsonValue::bool_value() const { return false; }
+    const string& JsonValue::string_value() const { return statics().empty_string; }
+    const Json::array& JsonValue::array_items() const { return statics().empty_vector; }
+    const Json::object& JsonValue::object_items() const { return statics().empty_map; }
+    const Json& JsonValue::operator[](const std::string &key) const { return static_null(); }
+    const Json& JsonValue::operator[](size_t i) const { return static_null(); }
+
+    /*
+     * 比较器
+     * 同一种类型可能有不同的节点类，所以通过访问器比较
+     */
+    bool JsonValue::equals(const JsonValue* other) const {
+        if(type() == Json::ARRAY){
+            return array_items() == other->array_items();
+        }
+        const ObjectMembers a(this), b(other);
+        return a.size() == b.size()
+               && std::equal(a.begin(), a.end(), b.begin(),
+                             [](const ObjectMembers::Member& x, const ObjectMembers::Member& y){
+                                 return x.first == y.first && x.second == y.second;
+                             });
+    }
+
+    // 与std::map的operator<相同，按键值对的字典序比较
+    bool JsonValue::less(const JsonValue* other) const {
+        if(type() == Json::ARRAY){
+            return array_items() < other->array_items();
+        }
+        const ObjectMembers a(this), b(other);
+        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+                                            [](const ObjectMembers::Member& x, const ObjectMembers::Member& y){
+                                                return x.first < y.first || (!(y.first < x.first) && x.second < y.second);
+                                            });
+    }
+
+    const Json& JsonObject::operator[](const std::string &key) const {
+        auto iter = m_value.find(key);
+        return (iter == m_value.end() ) ? static_null() : iter->second;
+    }
+
+    const Json& JsonShapedObject::operator[](const std::string &key) const {
+        auto iter = m_shape->index.find(key);
+        return (iter == m_shape->index.end()) ? static_null() : m_value[iter->second];
+    }
+
+    template<class T>
+    const Json& JsonNumberArray<T>::operator[](size_t i) const {
+        return i < m_value.size() ? array_items()[i] : static_null();
+    }
+
+    const Json& JsonArray::operator[](size_t i) const {
+        if(i >= m_value.size()){
+            return static_null();
+        }
+        else{
+            return m_value[i];
+        }
+    }
+
+    /*
+     * 比较器
+     */
+    bool Json::operator==(const Json& other) const {
+        if(m_kind == HEAP && other.m_kind == HEAP && m_ptr == other.m_ptr){
+            return true;
+        }
+        const Type t = type();
+        if(t != other.type()){
+            return false;
+        }
+        // 两边都已经算过哈希时，哈希不同一定不相等
+        if(t == ARRAY || t == OBJECT){
+            const size_t lhs_hash = m_ptr->m_hash.load(std::memory_order_relaxed);
+            const size_t rhs_hash = other.m_ptr->m_hash.load(std::memory_order_relaxed);
+            if(lhs_hash && rhs_hash && lhs_hash != rhs_hash){
+                return false;
+            }
+        }
+        // int和double之间按数值比较
+        switch(t){
+            case NUL:       return true;
+            case BOOL:      return bool_value() == other.bool_value();
+            case NUMBER:    return number_value() == other.number_value();
+            case STRING:    return string_view_value() == other.string_view_value();
+            default:        return m_ptr->equals(other.m_ptr);
+        }
+    }
+
+    bool Json::operator<(const Json& other) const {
+        if(m_kind == HEAP && other.m_kind == HEAP && m_ptr == other.m_ptr){
+            return false;
+        }
+        const Type t = type();
+        if(t != other.type()){
+            return t < other.type();
+        }
+        switch(t){
+            case NUL:       return false;
+            case BOOL:      return bool_value() < other.bool_value();
+            case NUMBER:    return number_value() < other.number_value();
+            case STRING:    return string_view_value() < other.string_view_value();
+            default:        return m_ptr->less(other.m_ptr);
+        }
+    }
+
+    /*
+     * 解析
+     * C风格的字符串更适合打印错误消息
+     */
+    static inline string esc(char c){
+        char buf[12];
+        if(static_cast<uint8_t>(c) >= 0x20 && static_cast<uint8_t>(c) <= 0x7f){
+            snprintf(buf, sizeof(buf), "'%c' (%d)", c, c);
+        }
+        else{
+            snprintf(buf, sizeof(buf), "(%d)", c);
+        }
+        return string(buf);
+    }
+
+    static inline bool in_range(long x, long lower, long upper){
+        return (x >= lower && x <= upper);
+    }
+
+    /*
+     * 结构哈希
+     * 与operator==一致：整数和浮点数按数值计算，对象的成员与顺序无关
+     */
+    static size_t hash_combine(size_t seed, size_t value){
+        return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    }
+
+    static size_t hash_number(double value){
+        // 0.0和-0.0相等
+        return hash_combine(Json::NUMBER, std::hash<double>()(value + 0.0));
+    }
+
+    static size_t hash_string(std::string_view value){
+        return hash_combine(Json::STRING, std::hash<std::string_view>()(value));
+    }
+
+    static size_t hash_scalar(const Json& value){
+        switch(value.type()){
+            case Json::BOOL:
+                return hash_combine(Json::BOOL, value.bool_value());
+            case Json::NUMBER:
+                return hash_number(value.number_value());
+            case Json::STRING:
+                return hash_string(value.string_view_value());
+            default:
+                return static_cast<size_t>(value.type());
+        }
+    }
+
+    static size_t hash_member(const string& key, size_t value_hash){
+        return hash_combine(std::hash<string>()(key), value_hash);
+    }
+
+    // 0用来表示还没有计算，所有的结果都要经过这里，内联和堆上的值才能一致
+    static size_t nonzero_hash(size_t hash){
+        return hash ? hash : 1;
+    }
+
+    size_t Json::hash() const {
+        if(m_kind != HEAP){
+            return nonzero_hash(hash_scalar(*this));
+        }
+        size_t hash = m_ptr->m_hash.load(std::memory_order_relaxed);
+        if(!hash){
+            // 多个线程同时计算得到的结果相同，不需要同步
+            hash = nonzero_hash(m_ptr->compute_hash());
+            if(!m_ptr->m_lent_children){
+                m_ptr->m_hash.store(hash, std::memory_order_relaxed);
+            }
+        }
+        return hash;
+    }
+
+    size_t JsonValue::compute_hash() const {
+        switch(type()){
+            case Json::NUMBER:
+                return hash_number(number_value());
+            case Json::STRING:
+                return hash_string(string_view_value());
+            case Json::ARRAY:{
+                size_t hash = Json::ARRAY;
+                for(const Json& item : array_items()){
+                    hash = hash_combine(hash, item.hash());
+                }
+                return hash;
+            }
+            case Json::OBJECT:{
+                size_t hash = Json::OBJECT;
+                for(const auto& item : object_items()){
+                    hash += hash_member(item.first, item.second.hash());
+                }
+                return hash;
+            }
+            default:
+                return static_cast<size_t>(type());
+        }
+    }
+
+    size_t JsonShapedObject::compute_hash() const {
+        size_t hash = Json::OBJECT;
+        for(size_t k = 0; k < m_value.size(); k++){
+            hash += hash_member(m_shape->keys[k], m_value[k].hash());
+        }
+        return hash;
+    }
+
+    template<class T>
+    size_t JsonNumberArray<T>::compute_hash() const {
+        size_t hash = Json::ARRAY;
+        for(const T value : m_value){
+            hash = hash_combine(hash, nonzero_hash(hash_number(value)));
+        }
+        return hash;
+    }
+
+    /*
+     * 解析时使用的查重表
+     * 每个哈希值只保存一个节点，冲突时不替换
+     * 哈希相同时由same(保存的节点, value)确认两者可以互相替换
+     */
+    struct DedupTable{
+        const size_t max_entries;
+        std::unordered_map<size_t, Json> nodes;
+
+        template<class Same>
+        Json intern(Json&& value, size_t hash, Same same){
+            auto iter = nodes.find(hash);
+            if(iter != nodes.end()){
+                return same(iter->second, value) ? iter->second : move(value);
+            }
+            if(nodes.size() < max_entries){
+                nodes.emplace(hash, value);
+            }
+            return move(value);
+        }
+    };
+
+    /*
+     * Json解析器
+     */
+    struct JsonParser final{
+        /*
+         * 状态信息
+         */
+        const string& str;
+        size_t i;
+        string& err;
+        bool failed;
+        const JsonParse strategy;
+        // 数组、对象和字符串节点从这里分配
+        std::pmr::memory_resource* resource;
+        const bool lazy_numbers;
+        // borrow_strings时保存整个输入的字符串节点，str就是它的内容
+        const Json* buffer;
+        // share_shapes时使用的形状表
+        ShapeTable* shapes;
+        // dedup时使用的查重表，last_hash是最近一次parse_json()返回值的哈希
+        DedupTable* dedup;
+        size_t last_hash;
+        const bool typed_arrays;
+
+        typedef std::pmr::vector<std::pair<string, Json>> Members;
+
+        // 未指定时使用默认的memory_resource
+        std::pmr::polymorphic_allocator<char> allocator() const {
+            return resource ? std::pmr::polymorphic_allocator<char>(resource) : std::pmr::polymorphic_allocator<char>();
+        }
+
+        /*
+         * 解析失败时的标记函数
+         * fail(msg, err_ret = Json())
+         */
+        Json fail(string&& msg){
+            return fail(move(msg), Json());
+        }
+
+        template<class T>
+        T fail(string&& msg, const T err_ret){
+            if(!failed){
+                err = std::move(msg);
+            }
+            failed = true;
+            return err_ret;
+        }
+
+        /*
+         * 将解析器向前移动
+         * 直到不是空白字符
+         * consume_whitespace
+         */
+        void consume_whitespace(){
+            while(str[i] == ' ' || str[i] == '\r' || str[i] == '\n' || str[i] == '\t'){
+                i++;
+            }
+        }
+
+        /*
+         * 对注释进行处理
+         * Json中的注释和C/C++中的一样
+         */
+        bool consume_comment(){
+            // 是否找到目标位置
+            bool comment_found = false;
+            if(str[i] == '/'){
+                i++;
+                if(i == str.size()){
+                    return fail("unexpected end of input after start of comment", false);
+                }
+                // 单行注释
+                if(str[i] == '/'){
+                    i++;
+                    while(i < str.size() && str[i] != '\n'){
+                        i++;
+                    }
+                    comment_found = true;
+                }
+                // 多行注释
+                else if(str[i] == '*'){
+                    i++;
+                    if(i > str.size() - 2){
+                        return fail("unexpected end of input multi-line comment", false);
+                    }
+                    while(!(str[i] == '*' && str[i+1] == '/')){
+                        i++;
+                        if(i > str.size() - 2){
+                            return fail("unexpected end of input inside mutil-line comment", false);
+                        }
+                    }
+                    i += 2;
+                    comment_found = true;
+                }
+                else{
+                    return fail("malformed comment", false);
+                }
+            }
+            return comment_found;
+        }
+
+        /*
+         * 移动解析器
+         * 直到其不是空白符也不是注释
+         */
+        void consume_garbage(){
+            consume_whitespace();
+            if(strategy == JsonParse::COMMENTS){
+                bool comment_found = false;
+                do{
+                    comment_found = consume_comment();
+                    if(failed){
+                        return;
+                    }
+                    consume_whitespace();
+                }
+                while(comment_found);
+            }
+        }
+
+        /*
+         * 返回下一个非空白字符
+         * 若是到达结尾都还还没找到，将会标记一个错误并返回0
+         */
+        char get_next_token(){
+            consume_garbage();
+            if(failed){
+                return static_cast<char>(0);
+            }
+            if(i == str.size()){
+                return fail("unexpected end of input", static_cast<char>(0));
+            }
+            return str[i++];
+        }
+
+        /*
+         * 将unicode字符转换为utf-8，并添加到out中
+         */
+        template<class String>
+        void encode_utf8(long pt, String & out) {
+            if (pt < 0)
+                return;
+
+            if (pt < 0x80) {
+                out += static_cast<char>(pt);
+            } else if (pt < 0x800) {
+                out += static_cast<char>((pt >> 6) | 0xC0);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            } else if (pt < 0x10000) {
+                out += static_cast<char>((pt >> 12) | 0xE0);
+                out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            } else {
+                out += static_cast<char>((pt >> 18) | 0xF0);
+                out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+                out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            }
+        }
+
+        /*
+         * 解析字符串
+         * 从当前位置开始解析
+         *
+         * 这段代码对编码的认识程序要求很高
+         * 而我只熟悉ASCII，对unicode不懂
+         * 因此直接复制的大佬源码，请谅解
+         *
+         * 结果写在out后面，out可以是带memory_resource的std::pmr::string
+         */
+        string parse_string() {
+            return parse_string(string());
+        }
+
+        template<class String>
+        String parse_string(String out) {
+            long last_escaped_codepoint = -1;
+            while (true) {
+                if (i == str.size())
+                    return fail("unexpected end of input in string", "");
+
+                char ch = str[i++];
+
+                if (ch == '"') {
+                    encode_utf8(last_escaped_codepoint, out);
+                    return out;
+                }
+
+                if (in_range(ch, 0, 0x1f))
+                    return fail("unescaped " + esc(ch) + " in string", "");
+
+                // The usual case: non-escaped characters
+                if (ch != '\\') {
+                    encode_utf8(last_escaped_codepoint, out);
+                    last_escaped_codepoint = -1;
+                    out += ch;
+                    continue;
+                }
+
+                // Handle escapes
+                if (i == str.size())
+                    return fail("unexpected end of input in string", "");
+
+                ch = str[i++];
+
+                if (ch == 'u') {
+                    // Extract 4-byte escape sequence
+                    string esc = str.substr(i, 4);
+                    // Explicitly check length of the substring. The following loop
+                    // relies on std::string returning the terminating NUL when
+                    // accessing str[length]. Checking here reduces brittleness.
+                    if (esc.length() < 4) {
+                        return fail("bad \\u escape: " + esc, "");
+                    }
+                    for (size_t j = 0; j < 4; j++) {
+                        if (!in_range(esc[j], 'a', 'f') && !in_range(esc[j], 'A', 'F')
+                            && !in_range(esc[j], '0', '9'))
+                            return fail("bad \\u escape: " + esc, "");
+                    }
+
+                    long codepoint = strtol(esc.data(), nullptr, 16);
+
+                    // JSON specifies that characters outside the BMP shall be encoded as a pair
+                    // of 4-hex-digit \u escapes encoding their surrogate pair components. Check
+                    // whether we're in the middle of such a beast: the previous codepoint was an
+                    // escaped lead (high) surrogate, and this is a trail (low) surrogate.
+                    if (in_range(last_escaped_codepoint, 0xD800, 0xDBFF)
+                        && in_range(codepoint, 0xDC00, 0xDFFF)) {
+                        // Reassemble the two surrogate pairs into one astral-plane character, per
+                        // the UTF-16 algorithm.
+                        encode_utf8((((last_escaped_codepoint - 0xD800) << 10)
+                                     | (codepoint - 0xDC00)) + 0x10000, out);
+                        last_escaped_codepoint = -1;
+                    } else {
+                        encode_utf8(last_escaped_codepoint, out);
+                        last_escaped_codepoint = codepoint;
+                    }
+
+                    i += 4;
+                    continue;
+                }
+
+                encode_utf8(last_escaped_codepoint, out);
+                last_escaped_codepoint = -1;
+
+                if (ch == 'b') {
+                    out += '\b';
+                } else if (ch == 'f') {
+                    out += '\f';
+                } else if (ch == 'n') {
+                    out += '\n';
+                } else if (ch == 'r') {
+                    out += '\r';
+                } else if (ch == 't') {
+                    out += '\t';
+                } else if (ch == '"' || ch == '\\' || ch == '/') {
+                    out += ch;
+                } else {
+                    return fail("invalid escape character " + esc(ch), "");
+                }
+            }
+        }
+
+        /*
+         * 对double类型进行解析
+         */
+        Json parse_number() {
+            size_t start_pos = i;
+
+            if (str[i] == '-')
+                i++;
+
+            // Integer part
+            if (str[i] == '0') {
+                i++;
+                if (in_range(str[i], '0', '9'))
+                    return fail("leading 0s not permitted in numbers");
+            } else if (in_range(str[i], '1', '9')) {
+                i++;
+                while (in_range(str[i], '0', '9'))
+                    i++;
+            } else {
+                return fail("invalid " + esc(str[i]) + " in number");
+            }
+
+            // "-0"转换成int会丢掉符号，延迟模式下保留原文
+            if (str[i] != '.' && str[i] != 'e' && str[i] != 'E'
+                && (i - start_pos) <= static_cast<size_t>(std::numeric_limits<int>::digits10)
+                && !(lazy_numbers && str.compare(start_pos, i - start_pos, "-0") == 0)) {
+                return std::atoi(str.c_str() + start_pos);
+            }
+
+            // Decimal part
+            if (str[i] == '.') {
+                i++;
+                if (!in_range(str[i], '0', '9'))
+                    return fail("at least one digit required in fractional part");
+
+                while (in_range(str[i], '0', '9'))
+                    i++;
+            }
+
+            // Exponent part
+            if (str[i] == 'e' || str[i] == 'E') {
+                i++;
+
+                if (str[i] == '+' || str[i] == '-')
+                    i++;
+
+                if (!in_range(str[i], '0', '9'))
+                    return fail("at least one digit required in exponent");
+
+                while (in_range(str[i], '0', '9'))
+                    i++;
+            }
+
+            if (lazy_numbers)
+                return Json::make_node<JsonLazyNumber>(resource, std::string_view(str).substr(start_pos, i - start_pos),
+                                                       allocator());
+            return std::strtod(str.c_str() + start_pos, nullptr);
+        }
+
+        /* expect(str, res)
+         *
+         * Expect that 'str' starts at the character that was just read. If it does, advance
+         * the input and return res. If not, flag an error.
+         */
+        Json expect(const string &expected, Json res) {
+            assert(i != 0);
+            i--;
+            if (str.compare(i, expected.length(), expected) == 0) {
+                i += expected.length();
+                return res;
+            } else {
+                return fail("parse error: expected " + expected + ", got " + str.substr(i, expected.length()));
+            }
+        }
+
+        /* parse_json()
+         *
+         * Parse a JSON object.
+         */
+        /*
+         * 查重命中时确认两个值写出来完全一样
+         * operator==认为1和1.0、0.0和-0.0相等，合并它们会改变dump()和二进制编码的结果
+         * 延迟转换的数字比较原文，不会为了查重而转换
+         */
+        static bool same_representation(const Json& a, const Json& b) {
+            if (a.m_kind != b.m_kind)
+                return false;
+            switch (a.m_kind) {
+                case Json::INLINE_NULL:   return true;
+                case Json::INLINE_BOOL:   return a.m_bool == b.m_bool;
+                case Json::INLINE_INT:    return a.m_int == b.m_int;
+                case Json::INLINE_DOUBLE: return memcmp(&a.m_double, &b.m_double, sizeof(double)) == 0;
+                case Json::HEAP:          break;
+            }
+            if (a.m_ptr == b.m_ptr)
+                return true;
+            const Json::Type type = a.type();
+            if (type != b.type())
+                return false;
+            if (type == Json::NUMBER) {
+                // 堆上的数字只有保存原文的那一种
+                const auto* x = dynamic_cast<const JsonLazyNumber*>(a.m_ptr);
+                const auto* y = dynamic_cast<const JsonLazyNumber*>(b.m_ptr);
+                return x && y && x->text() == y->text();
+            }
+            if (type == Json::STRING)
+                return a.string_view_value() == b.string_view_value();
+            if (type == Json::ARRAY) {
+                // 连续保存的数字数组只和同样保存的数组比较缓冲区，不生成Json::array
+                const auto* xd = dynamic_cast<const JsonNumberArray<double>*>(a.m_ptr);
+                const auto* yd = dynamic_cast<const JsonNumberArray<double>*>(b.m_ptr);
+                if (xd || yd) {
+                    if (!xd || !yd || xd->span().size != yd->span().size)
+                        return false;
+                    return memcmp(xd->span().data, yd->span().data, xd->span().size * sizeof(double)) == 0;
+                }
+                const auto* xi = dynamic_cast<const JsonNumberArray<int>*>(a.m_ptr);
+                const auto* yi = dynamic_cast<const JsonNumberArray<int>*>(b.m_ptr);
+                if (xi || yi)
+                    return xi && yi && std::equal(xi->span().begin(), xi->span().end(),
+                                                  yi->span().begin(), yi->span().end());
+                const Json::array& x = a.array_items();
+                const Json::array& y = b.array_items();
+                return std::equal(x.begin(), x.end(), y.begin(), y.end(), same_representation);
+            }
+            const ObjectMembers x(a), y(b);
+            return x.size() == y.size()
+                   && std::equal(x.begin(), x.end(), y.begin(),
+                                 [](const ObjectMembers::Member& m, const ObjectMembers::Member& n) {
+                                     return m.first == n.first && same_representation(m.second, n.second);
+                                 });
+        }
+
+        Json parse_json(int depth) {
+            Json value = parse_value(depth);
+            if (!dedup || failed)
+                return value;
+            // 数字和容器的哈希由parse_value()计算
+            if (!value.is_number() && !value.is_array() && !value.is_object())
+                last_hash = hash_scalar(value);
+            // 数字、布尔值和null直接保存在Json中，不需要共享
+            if (value.is_number() || value.is_bool() || value.is_null())
+                return value;
+            return dedup->intern(std::move(value), last_hash, same_representation);
+        }
+
+        Json parse_value(int depth) {
+            if (depth > max_depth) {
+                return fail("exceeded maximum nesting depth");
+            }
+
+            char ch = get_next_token();
+            if (failed)
+                return Json();
+
+            if (ch == '-' || (ch >= '0' && ch <= '9')) {
+                i--;
+                const size_t start = i;
+                Json number = parse_number();
+                // 延迟转换的数字按原文计算哈希，不会为了查重而转换，写法不同的相等数字也不会合并
+                if (dedup)
+                    last_hash = number.m_kind == Json::HEAP
+                        ? hash_combine(Json::NUMBER, std::hash<std::string_view>()(
+                              std::string_view(str).substr(start, i - start)))
+                        : hash_scalar(number);
+                return number;
+            }
+
+            if (ch == 't')
+                return expect("true", true);
+
+            if (ch == 'f')
+                return expect("false", false);
+
+            if (ch == 'n')
+                return expect("null", Json());
+
+            if (ch == '"') {
+                if (buffer) {
+                    // 没有转义的长字符串直接借用输入，短字符串放在string内部本来就不需要额外分配
+                    static const size_t inline_capacity = string().capacity();
+                    size_t end = i;
+                    while (end < str.size() && str[end] != '"' && str[end] != '\\'
+                           && static_cast<uint8_t>(str[end]) >= 0x20)
+                        end++;
+                    if (end < str.size() && str[end] == '"' && end - i > inline_capacity) {
+                        const std::string_view view(str.data() + i, end - i);
+                        i = end + 1;
+                        return Json::make_node<JsonBorrowedString>(resource, *buffer, view);
+                    }
+                }
+                // 指定了resource时内容也从它分配，否则仍然用std::string
+                if (resource && resource != std::pmr::new_delete_resource())
+                    return Json::make_node<JsonPmrString>(resource, parse_string(std::pmr::string(allocator())));
+                return Json::make_node<JsonString>(resource, parse_string());
+            }
+
+            // 容器和字符串都移动进节点，不会逐层拷贝
+            if (ch == '{') {
+                Json::object data(allocator());
+                // 共享形状时先按出现的顺序收集，最后再决定怎么保存
+                Members members(allocator());
+                size_t hash = Json::OBJECT;
+                last_hash = hash;
+                ch = get_next_token();
+                if (ch == '}')
+                    return Json(std::move(data));
+
+                while (1) {
+                    if (ch != '"')
+                        return fail("expected '\"' in object, got " + esc(ch));
+
+                    string key = parse_string();
+                    if (failed)
+                        return Json();
+
+                    ch = get_next_token();
+                    if (ch != ':')
+                        return fail("expected ':' in object, got " + esc(ch));
+
+                    Json value = parse_json(depth + 1);
+                    if (failed)
+                        return Json();
+                    // 重复的键会使哈希不同，只是少共享一些节点
+                    if (dedup)
+                        hash += hash_member(key, last_hash);
+                    if (shapes)
+                        members.emplace_back(std::move(key), std::move(value));
+                    else
+                        data[std::move(key)] = std::move(value);
+
+                    ch = get_next_token();
+                    if (ch == '}')
+                        break;
+                    if (ch != ',')
+                        return fail("expected ',' in object, got " + esc(ch));
+
+                    ch = get_next_token();
+                }
+                last_hash = hash;
+                if (shapes)
+                    return make_object(std::move(members));
+                return Json(std::move(data));
+            }
+
+            if (ch == '[') {
+                Json::array data(allocator());
+                size_t hash = Json::ARRAY;
+                last_hash = hash;
+                ch = get_next_token();
+                if (ch == ']')
+                    return Json(std::move(data));
+
+                while (1) {
+                    i--;
+                    data.push_back(parse_json(depth + 1));
+                    if (failed)
+                        return Json();
+                    if (dedup)
+                        hash = hash_combine(hash, last_hash);
+
+                    ch = get_next_token();
+                    if (ch == ']')
+                        break;
+                    if (ch != ',')
+                        return fail("expected ',' in list, got " + esc(ch));
+
+                    ch = get_next_token();
+                    (void)ch;
+                }
+                last_hash = hash;
+                if (typed_arrays)
+                    return make_array(std::move(data));
+                return Json(std::move(data));
+            }
+
+            return fail("expected value, got " + esc(ch));
+        }
+        /******************* 复制部分结束 ********************/
+
+        /*
+         * 按形状保存对象
+         * 有重复的键或者形状表已满时退回到普通的对象，重复的键以最后一个为准
+         */
+        Json make_object(Members&& members) {
+            std::stable_sort(members.begin(), members.end(),
+                             [](const Members::value_type& a, const Members::value_type& b) {
+                                 return a.first < b.first;
+                             });
+            bool unique = true;
+            for (size_t k = 1; k < members.size() && unique; k++)
+                unique = members[k - 1].first != members[k].first;
+
+            std::shared_ptr<const JsonShape> shape = unique ? shapes->find(members, allocator().resource()) : nullptr;
+            if (!shape) {
+                Json::object data(allocator());
+                for (auto& member : members)
+                    data[std::move(member.first)] = std::move(member.second);
+                return Json(std::move(data));
+            }
+            Json::array values(allocator());
+            values.reserve(members.size());
+            for (auto& member : members)
+                values.push_back(std::move(member.second));
+            return Json::make_node<JsonShapedObject>(resource, std::move(shape), std::move(values));
+        }
+
+        /*
+         * 全是int或者全是double的数组连续保存
+         * 两种混在一起时保持普通的数组，否则整数会变成double，二进制编码和快照的输出都会改变
+         * 原文保存的数字在堆上，不会出现在这样的数组中
+         */
+        Json make_array(Json::array&& data) {
+            bool all_int = true;
+            bool all_double = true;
+            for (const Json& value : data) {
+                all_int = all_int && value.m_kind == Json::INLINE_INT;
+                all_double = all_double && value.m_kind == Json::INLINE_DOUBLE;
+                if (!all_int && !all_double)
+                    return Json(std::move(data));
+            }
+            if (all_int) {
+                std::pmr::vector<int> numbers(allocator());
+                numbers.reserve(data.size());
+                for (const Json& value : data)
+                    numbers.push_back(value.m_int);
+                return Json::make_node<JsonNumberArray<int>>(resource, std::move(numbers));
+            }
+            std::pmr::vector<double> numbers(allocator());
+            numbers.reserve(data.size());
+            for (const Json& value : data)
+                numbers.push_back(value.m_double);
+            return Json::make_node<JsonNumberArray<double>>(resource, std::move(numbers));
+        }
+
+        // 解析整个输入，检查是否有不必要的“垃圾”跟随在尾部
+        Json parse_document() {
+            Json result = parse_json(0);
+            consume_garbage();
+            if (failed)
+                return Json();
+            if (i != str.size())
+                return fail("unexpected trailing " + esc(str[i]));
+            return result;
+        }
+    };
+
+
+    Json Json::parse(const string& in, string& err, JsonParse strategy){
+        ParseOptions options;
+        options.strategy = strategy;
+        return parse(in, err, options);
+    }
+
+    Json Json::parse(const string& in, string& err, const ParseOptions& options){
+        // 借用字符串时先把输入复制到一个带引用计数的缓冲区中
+        if(options.borrow_strings){
+            return parse(string(in), err, options);
+        }
+        ShapeTable shapes;
+        DedupTable dedup {options.dedup_max_entries, {}};
+        JsonParser parser {in, 0, err, false, options.strategy, options.resource, options.lazy_numbers, nullptr,
+                           options.share_shapes ? &shapes : nullptr, options.dedup ? &dedup : nullptr, 0,
+                           options.typed_arrays};
+        return parser.parse_document();
+    }
+
+    Json Json::parse(string&& in, string& err, const ParseOptions& options){
+        if(!options.borrow_strings){
+            return parse(static_cast<const string&>(in), err, options);
+        }
+        const Json buffer(move(in));
+        ShapeTable shapes;
+        DedupTable dedup {options.dedup_max_entries, {}};
+        JsonParser parser {buffer.string_value(), 0, err, false, options.strategy, options.resource, options.lazy_numbers, &buffer,
+                           options.share_shapes ? &shapes : nullptr, options.dedup ? &dedup : nullptr, 0,
+                           options.typed_arrays};
+        return parser.parse_document();
+    }
+
+    /*
+     * 记录在.h文件中
+     */
+    vector<Json> Json::parse_multi(const string& in,
+                                   std::string::size_type& parser_stop_pos,
+                                   string& err,
+                                   JsonParse strategy){
+        ParseOptions options;
+        options.strategy = strategy;
+        return parse_multi(in, parser_stop_pos, err, options);
+    }
+
+    vector<Json> Json::parse_multi(const string& in,
+                                   std::string::size_type& parser_stop_pos,
+                                   string& err,
+                                   const ParseOptions& options){
+        const Json buffer = options.borrow_strings ? Json(in) : Json();
+        // 同一个输入中的多个文档共享形状表和查重表
+        ShapeTable shapes;
+        DedupTable dedup {options.dedup_max_entries, {}};
+        JsonParser parser {options.borrow_strings ? buffer.string_value() : in, 0, err, false,
+                           options.strategy, options.resource, options.lazy_numbers,
+                           options.borrow_strings ? &buffer : nullptr,
+                           options.share_shapes ? &shapes : nullptr, options.dedup ? &dedup : nullptr, 0,
+                           options.typed_arrays};
+        parser_stop_pos = 0;
+        vector<Json> json_vec;
+        while(parser.i != in.size() && !parser.failed){
+            json_vec.push_back(parser.parse_json(0));
+            if(parser.failed){
+                break;
+            }
+
+            // 检查其它对象
+            parser.consume_garbage();
+            if(parser.failed){
+                break;
+            }
+            parser_stop_pos = parser.i;
+        }
+        return json_vec;
+    }
+
+    /*
+     * 对Json数据的结构进行检查
+     */
+    bool Json::has_shape(const shape & types, string & err) const {
+        if (!is_object()) {
+            err = "expected JSON object, got " + dump();
+            return false;
+        }
+
+        const ObjectMembers members(*this);
         for (auto & item : types) {
-            const auto it = obj_items.find(item.first);
-            if (it == obj_items.cend() || it->second.type() != item.second) {
+            const Json* value = members.find(item.first);
+            if (!value || value->type() != item.second) {
                 err = "bad type for " + item.first + " in " + dump();
                 return false;
             }
         }
         return true;
     }
+    /*
+     * MessagePack
+     * 多字节的整数和浮点数都是大端序
+     */
+    static void put_be(uint64_t value, int bytes, string& out){
+        for(int shift = (bytes - 1) * 8; shift >= 0; shift -= 8){
+            out += static_cast<char>((value >> shift) & 0xff);
+        }
+    }
+
+    // 写出长度头：短的用fix格式，否则按长度选8/16/32位
+    static void msgpack_length(size_t n, uint8_t fix, size_t fix_max,
+                               uint8_t tag8, uint8_t tag16, uint8_t tag32, string& out){
+        if(n <= fix_max){
+            out += static_cast<char>(fix | n);
+        }
+        else if(tag8 && n <= 0xff){
+            out += static_cast<char>(tag8);
+            put_be(n, 1, out);
+        }
+        else if(n <= 0xffff){
+            out += static_cast<char>(tag16);
+            put_be(n, 2, out);
+        }
+        else{
+            out += static_cast<char>(tag32);
+            put_be(n, 4, out);
+        }
+    }
+
+    void Json::to_msgpack(string& out) const {
+        switch(type()){
+            case NUL:
+                out += static_cast<char>(0xc0);
+                break;
+            case BOOL:
+                out += static_cast<char>(bool_value() ? 0xc3 : 0xc2);
+                break;
+            case NUMBER:
+                if(stores_integer()){
+                    const int value = int_value();
+                    if(value >= -32 && value <= 0x7f){
+                        // positive/negative fixint
+                        out += static_cast<char>(value);
+                    }
+                    else if(value >= 0){
+                        out += static_cast<char>(value <= 0xff ? 0xcc : value <= 0xffff ? 0xcd : 0xce);
+                        put_be(static_cast<uint64_t>(value), value <= 0xff ? 1 : value <= 0xffff ? 2 : 4, out);
+                    }
+                    else{
+                        const int bytes = value >= -0x80 ? 1 : value >= -0x8000 ? 2 : 4;
+                        out += static_cast<char>(bytes == 1 ? 0xd0 : bytes == 2 ? 0xd1 : 0xd2);
+                        put_be(static_cast<uint64_t>(static_cast<int64_t>(value)), bytes, out);
+                    }
+                }
+                else{
+                    const double value = number_value();
+                    const float narrow = static_cast<float>(value);
+                    uint64_t bits;
+                    // float32能无损表示时用float32，解码回来还是double
+                    if(static_cast<double>(narrow) == value){
+                        uint32_t bits32;
+                        memcpy(&bits32, &narrow, sizeof(bits32));
+                        out += static_cast<char>(0xca);
+                        put_be(bits32, 4, out);
+                    }
+                    else{
+                        memcpy(&bits, &value, sizeof(bits));
+                        out += static_cast<char>(0xcb);
+                        put_be(bits, 8, out);
+                    }
+                }
+                break;
+            case STRING:
+                msgpack_length(string_view_value().size(), 0xa0, 31, 0xd9, 0xda, 0xdb, out);
+                out += string_view_value();
+                break;
+            case ARRAY:
+                msgpack_length(array_items().size(), 0x90, 15, 0, 0xdc, 0xdd, out);
+                for(const auto& item : array_items()){
+                    item.to_msgpack(out);
+                }
+                break;
+            case OBJECT:{
+                const ObjectMembers members(*this);
+                msgpack_length(members.size(), 0x80, 15, 0, 0xde, 0xdf, out);
+                for(const auto& kv : members){
+                    msgpack_length(kv.first.size(), 0xa0, 31, 0xd9, 0xda, 0xdb, out);
+                    out += kv.first;
+                    kv.second.to_msgpack(out);
+                }
+                break;
+            }
+        }
+    }
+
+    // 整数放得进int就保存成int，否则只能退化成double
+    static Json make_integer(int64_t value){
+        if(value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()){
+            return static_cast<int>(value);
+        }
+        return static_cast<double>(value);
+    }
+
+    namespace{
+        /*
+         * MessagePack解析器
+         * 结构与JsonParser一致：出错时记录第一条错误消息并返回Json()
+         */
+        struct MsgpackParser final{
+            const string& str;
+            size_t i;
+            string& err;
+            bool failed;
+
+            Json fail(string&& msg){
+                if(!failed){
+                    err = "msgpack: " + msg + " at offset " + std::to_string(i);
+                }
+                failed = true;
+                return Json();
+            }
+
+            // 读取n个字节的大端整数，不够时标记错误
+            bool read_be(size_t n, uint64_t& value){
+                if(str.size() - i < n){
+                    fail("unexpected end of input");
+                    return false;
+                }
+                value = 0;
+                for(size_t k = 0; k < n; k++){
+                    value = (value << 8) | static_cast<uint8_t>(str[i++]);
+                }
+                return true;
+            }
+
+            bool parse_string(size_t n, string& out){
+                if(str.size() - i < n){
+                    fail("unexpected end of input in string");
+                    return false;
+                }
+                out.assign(str, i, n);
+                i += n;
+                return true;
+            }
+
+            Json parse_array(size_t n, int depth){
+                Json::array data;
+                // 长度来自输入，不能直接相信，每个元素至少占一个字节
+                data.reserve(n < str.size() - i ? n : str.size() - i);
+                for(size_t k = 0; k < n; k++){
+                    data.push_back(parse_value(depth + 1));
+                    if(failed){
+                        return Json();
+                    }
+                }
+                return Json(move(data));
+            }
+
+            Json parse_map(size_t n, int depth){
+                Json::object data;
+                for(size_t k = 0; k < n; k++){
+                    string key;
+                    if(!parse_key(key)){
+                        return Json();
+                    }
+                    Json value = parse_value(depth + 1);
+                    if(failed){
+                        return Json();
+                    }
+                    data[move(key)] = move(value);
+                }
+                return Json(move(data));
+            }
+
+            bool parse_key(string& key){
+                if(i == str.size()){
+                    fail("unexpected end of input in map");
+                    return false;
+                }
+                const uint8_t tag = static_cast<uint8_t>(str[i]);
+                uint64_t n;
+                if(tag >= 0xa0 && tag <= 0xbf){
+                    i++;
+                    n = tag & 0x1f;
+                }
+                else if(tag >= 0xd9 && tag <= 0xdb){
+                    i++;
+                    if(!read_be(size_t(1) << (tag - 0xd9), n)){
+                        return false;
+                    }
+                }
+                else{
+                    fail("map key is not a string");
+                    return false;
+                }
+                return parse_string(static_cast<size_t>(n), key);
+            }
+
+            Json parse_value(int depth){
+                if(depth > max_depth){
+                    return fail("exceeded maximum nesting depth");
+                }
+                if(i == str.size()){
+                    return fail("unexpected end of input");
+                }
+                const uint8_t tag = static_cast<uint8_t>(str[i++]);
+                uint64_t n;
+
+                if(tag <= 0x7f){
+                    return static_cast<int>(tag);
+                }
+                if(tag >= 0xe0){
+                    return static_cast<int>(static_cast<int8_t>(tag));
+                }
+                if(tag >= 0x80 && tag <= 0x8f){
+                    return parse_map(tag & 0x0f, depth);
+                }
+                if(tag >= 0x90 && tag <= 0x9f){
+                    return parse_array(tag & 0x0f, depth);
+                }
+                if(tag >= 0xa0 && tag <= 0xbf){
+                    string out;
+                    if(!parse_string(tag & 0x1f, out)){
+                        return Json();
+                    }
+                    return Json(move(out));
+                }
+
+                switch(tag){
+                    case 0xc0:
+                        return Json();
+                    case 0xc2:
+                        return false;
+                    case 0xc3:
+                        return true;
+                    case 0xca:{
+                        if(!read_be(4, n)){
+                            return Json();
+                        }
+                        const uint32_t bits = static_cast<uint32_t>(n);
+                        float value;
+                        memcpy(&value, &bits, sizeof(value));
+                        return static_cast<double>(value);
+                    }
+                    case 0xcb:{
+                        if(!read_be(8, n)){
+                            return Json();
+                        }
+                        double value;
+                        memcpy(&value, &n, sizeof(value));
+                        return value;
+                    }
+                    case 0xcc: case 0xcd: case 0xce: case 0xcf:
+                        if(!read_be(size_t(1) << (tag - 0xcc), n)){
+                            return Json();
+                        }
+                        if(n > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+                            return static_cast<double>(n);
+                        }
+                        return make_integer(static_cast<int64_t>(n));
+                    case 0xd0: case 0xd1: case 0xd2: case 0xd3:{
+                        const size_t bytes = size_t(1) << (tag - 0xd0);
+                        if(!read_be(bytes, n)){
+                            return Json();
+                        }
+                        // 符号扩展
+                        const int unused = static_cast<int>(64 - bytes * 8);
+                        const int64_t value = unused ? static_cast<int64_t>(n << unused) >> unused
+                                                     : static_cast<int64_t>(n);
+                        return make_integer(value);
+                    }
+                    case 0xd9: case 0xda: case 0xdb:{
+                        string out;
+                        if(!read_be(size_t(1) << (tag - 0xd9), n) || !parse_string(static_cast<size_t>(n), out)){
+                            return Json();
+                        }
+                        return Json(move(out));
+                    }
+                    case 0xdc: case 0xdd:
+                        if(!read_be(tag == 0xdc ? 2 : 4, n)){
+                            return Json();
+                        }
+                        return parse_array(static_cast<size_t>(n), depth);
+                    case 0xde: case 0xdf:
+                        if(!read_be(tag == 0xde ? 2 : 4, n)){
+                            return Json();
+                        }
+                        return parse_map(static_cast<size_t>(n), depth);
+                    default:{
+                        i--;
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "0x%02x", tag);
+                        return fail(string("unsupported type ") + buf);
+                    }
+                }
+            }
+        };
+    } // namespace none
+
+    Json Json::from_msgpack(const string& in, string& err){
+        MsgpackParser parser {in, 0, err, false};
+        Json result = parser.parse_value(0);
+        if(parser.failed){
+            return Json();
+        }
+        if(parser.i != in.size()){
+            return parser.fail("unexpected trailing bytes");
+        }
+        return result;
+    }
+    /*
+     * CBOR
+     * 每个数据项的第一个字节：高3位是主类型，低5位是附加信息
+     * 附加信息小于24时就是参数本身，24~27表示后面跟着1/2/4/8字节的参数
+     */
+    static void cbor_head(uint8_t major, uint64_t argument, string& out){
+        const uint8_t type = static_cast<uint8_t>(major << 5);
+        if(argument < 24){
+            out += static_cast<char>(type | argument);
+        }
+        else if(argument <= 0xff){
+            out += static_cast<char>(type | 24);
+            put_be(argument, 1, out);
+        }
+        else if(argument <= 0xffff){
+            out += static_cast<char>(type | 25);
+            put_be(argument, 2, out);
+        }
+        else if(argument <= 0xffffffff){
+            out += static_cast<char>(type | 26);
+            put_be(argument, 4, out);
+        }
+        else{
+            out += static_cast<char>(type | 27);
+            put_be(argument, 8, out);
+        }
+    }
+
+    void Json::to_cbor(string& out) const {
+        switch(type()){
+            case NUL:
+                out += static_cast<char>(0xf6);
+                break;
+            case BOOL:
+                out += static_cast<char>(bool_value() ? 0xf5 : 0xf4);
+                break;
+            case NUMBER:
+                if(stores_integer()){
+                    const int64_t value = int_value();
+                    if(value >= 0){
+                        cbor_head(0, static_cast<uint64_t>(value), out);
+                    }
+                    else{
+                        cbor_head(1, static_cast<uint64_t>(-1 - value), out);
+                    }
+                }
+                else{
+                    const double value = number_value();
+                    const float narrow = static_cast<float>(value);
+                    // float32能无损表示时用float32
+                    if(static_cast<double>(narrow) == value){
+                        uint32_t bits;
+                        memcpy(&bits, &narrow, sizeof(bits));
+                        out += static_cast<char>(0xfa);
+                        put_be(bits, 4, out);
+                    }
+                    else{
+                        uint64_t bits;
+                        memcpy(&bits, &value, sizeof(bits));
+                        out += static_cast<char>(0xfb);
+                        put_be(bits, 8, out);
+                    }
+                }
+                break;
+            case STRING:
+                cbor_head(3, string_view_value().size(), out);
+                out += string_view_value();
+                break;
+            case ARRAY:
+                cbor_head(4, array_items().size(), out);
+                for(const auto& item : array_items()){
+                    item.to_cbor(out);
+                }
+                break;
+            case OBJECT:{
+                const ObjectMembers members(*this);
+                cbor_head(5, members.size(), out);
+                for(const auto& kv : members){
+                    cbor_head(3, kv.first.size(), out);
+                    out += kv.first;
+                    kv.second.to_cbor(out);
+                }
+                break;
+            }
+        }
+    }
+
+    namespace{
+        /*
+         * CBOR解析器
+         * 结构与JsonParser一致：出错时记录第一条错误消息（带字节偏移）并返回Json()
+         */
+        struct CborParser final{
+            const string& str;
+            size_t i;
+            string& err;
+            bool failed;
+            // 错误是否只是因为数据还没收完，流式解码时需要区分
+            bool truncated;
+
+            Json fail(string&& msg){
+                return fail(move(msg), i);
+            }
+
+            Json fail(string&& msg, size_t offset){
+                if(!failed){
+                    err = "cbor: " + msg + " at offset " + std::to_string(offset);
+                }
+                failed = true;
+                return Json();
+            }
+
+            bool need(uint64_t n){
+                if(str.size() - i < n){
+                    truncated = true;
+                    fail("unexpected end of input");
+                    return false;
+                }
+                return true;
+            }
+
+            // 读出数据项的头部，indefinite为true表示这是一个不定长的数据项
+            bool read_head(uint8_t& major, uint64_t& argument, bool& indefinite){
+                if(!need(1)){
+                    return false;
+                }
+                const size_t start = i;
+                const uint8_t initial = static_cast<uint8_t>(str[i++]);
+                major = initial >> 5;
+                const uint8_t info = initial & 0x1f;
+                indefinite = false;
+                if(info < 24){
+                    argument = info;
+                    return true;
+                }
+                if(info <= 27){
+                    const size_t bytes = size_t(1) << (info - 24);
+                    if(!need(bytes)){
+                        return false;
+                    }
+                    argument = 0;
+                    for(size_t k = 0; k < bytes; k++){
+                        argument = (argument << 8) | static_cast<uint8_t>(str[i++]);
+                    }
+                    return true;
+                }
+                if(info == 31 && (major == 2 || major == 3 || major == 4 || major == 5 || major == 7)){
+                    indefinite = true;
+                    return true;
+                }
+                fail("reserved additional information", start);
+                return false;
+            }
+
+            // 不定长容器以0xff结束
+            bool at_break(){
+                if(!need(1)){
+                    return false;
+                }
+                if(static_cast<uint8_t>(str[i]) == 0xff){
+                    i++;
+                    return true;
+                }
+                return false;
+            }
+
+            bool parse_text(uint64_t length, bool indefinite, string& out){
+                if(!indefinite){
+                    if(!need(length)){
+                        return false;
+                    }
+                    out.append(str, i, static_cast<size_t>(length));
+                    i += static_cast<size_t>(length);
+                    return true;
+                }
+                // 不定长字符串由若干个定长的文本分块组成
+                while(!at_break()){
+                    if(failed){
+                        return false;
+                    }
+                    const size_t start = i;
+                    uint8_t major;
+                    uint64_t chunk;
+                    bool chunk_indefinite;
+                    if(!read_head(major, chunk, chunk_indefinite)){
+                        return false;
+                    }
+                    if(major != 3 || chunk_indefinite){
+                        fail("invalid chunk in indefinite-length string", start);
+                        return false;
+                    }
+                    if(!parse_text(chunk, false, out)){
+                        return false;
+                    }
+                }
+                return !failed;
+            }
+
+            Json parse_value(int depth){
+                if(depth > max_depth){
+                    return fail("exceeded maximum nesting depth");
+                }
+                const size_t start = i;
+                uint8_t major;
+                uint64_t argument;
+                bool indefinite;
+                if(!read_head(major, argument, indefinite)){
+                    return Json();
+                }
+
+                switch(major){
+                    case 0:
+                        if(argument > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+                            return static_cast<double>(argument);
+                        }
+                        return make_integer(static_cast<int64_t>(argument));
+                    case 1:
+                        // 值为-1-argument
+                        if(argument > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+                            return -1.0 - static_cast<double>(argument);
+                        }
+                        return make_integer(-1 - static_cast<int64_t>(argument));
+                    case 2:
+                        return fail("byte strings are not supported", start);
+                    case 3:{
+                        string out;
+                        if(!parse_text(argument, indefinite, out)){
+                            return Json();
+                        }
+                        return Json(move(out));
+                    }
+                    case 4:{
+                        Json::array data;
+                        if(!indefinite){
+                            // 长度来自输入，不能直接相信，每个元素至少占一个字节
+                            data.reserve(argument < str.size() - i ? static_cast<size_t>(argument) : str.size() - i);
+                        }
+                        for(uint64_t k = 0; indefinite || k < argument; k++){
+                            if(indefinite && at_break()){
+                                break;
+                            }
+                            data.push_back(parse_value(depth + 1));
+                            if(failed){
+                                return Json();
+                            }
+                        }
+                        return Json(move(data));
+                    }
+                    case 5:{
+                        Json::object data;
+                        for(uint64_t k = 0; indefinite || k < argument; k++){
+                            if(indefinite && at_break()){
+                                break;
+                            }
+                            const size_t key_start = i;
+                            uint8_t key_major;
+                            uint64_t key_length;
+                            bool key_indefinite;
+                            if(!read_head(key_major, key_length, key_indefinite)){
+                                return Json();
+                            }
+                            if(key_major != 3){
+                                return fail("map key is not a text string", key_start);
+                            }
+                            string key;
+                            if(!parse_text(key_length, key_indefinite, key)){
+                                return Json();
+                            }
+                            Json value = parse_value(depth + 1);
+                            if(failed){
+                                return Json();
+                            }
+                            data[move(key)] = move(value);
+                        }
+                        return Json(move(data));
+                    }
+                    case 6:
+                        // tag只是语义上的标注，直接解析被标注的值
+                        return parse_value(depth + 1);
+                    default:
+                        return parse_simple(argument, indefinite, start);
+                }
+            }
+
+            Json parse_simple(uint64_t argument, bool indefinite, size_t start){
+                if(indefinite){
+                    return fail("unexpected break", start);
+                }
+                const uint8_t info = static_cast<uint8_t>(str[start]) & 0x1f;
+                if(info == 25){
+                    return decode_half(static_cast<uint16_t>(argument));
+                }
+                if(info == 26){
+                    const uint32_t bits = static_cast<uint32_t>(argument);
+                    float value;
+                    memcpy(&value, &bits, sizeof(value));
+                    return static_cast<double>(value);
+                }
+                if(info == 27){
+                    double value;
+                    memcpy(&value, &argument, sizeof(value));
+                    return value;
+                }
+                switch(argument){
+                    case 20:
+                        return false;
+                    case 21:
+                        return true;
+                    case 22:
+                    case 23:
+                        // undefined没有对应的Json值，按null处理
+                        return Json();
+                    default:
+                        return fail("unsupported simple value " + std::to_string(argument), start);
+                }
+            }
+
+            static double decode_half(uint16_t half){
+                const int exponent = (half >> 10) & 0x1f;
+                const int mantissa = half & 0x3ff;
+                double value;
+                if(exponent == 0){
+                    value = std::ldexp(mantissa, -24);
+                }
+                else if(exponent != 31){
+                    value = std::ldexp(mantissa + 1024, exponent - 25);
+                }
+                else{
+                    value = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                                          : std::numeric_limits<double>::quiet_NaN();
+                }
+                return (half & 0x8000) ? -value : value;
+            }
+        };
+    } // namespace none
+
+    Json Json::from_cbor(const string& in, string& err){
+        CborParser parser {in, 0, err, false, false};
+        Json result = parser.parse_value(0);
+        if(parser.failed){
+            return Json();
+        }
+        if(parser.i != in.size()){
+            return parser.fail("unexpected trailing bytes");
+        }
+        return result;
+    }
+
+    vector<Json> Json::from_cbor_multi(const string& in,
+                                       std::string::size_type& parser_stop_pos,
+                                       string& err){
+        CborParser parser {in, 0, err, false, false};
+        parser_stop_pos = 0;
+        vector<Json> json_vec;
+        while(parser.i != in.size()){
+            Json item = parser.parse_value(0);
+            if(parser.failed){
+                // 只是数据还没收完，不算错误
+                if(parser.truncated){
+                    err.clear();
+                }
+                break;
+            }
+            json_vec.push_back(move(item));
+            parser_stop_pos = parser.i;
+        }
+        return json_vec;
+    }
+    /*
+     * 二进制快照
+     *
+     * 文件头（32字节）：
+     *     char     magic[8]      "TJSNAP01"
+     *     uint32_t byte_order    写入时为0x01020304，用来检查字节序
+     *     uint32_t reserved
+     *     uint64_t root          根节点的偏移
+     *     uint64_t size          整个快照的字节数
+     *
+     * 节点都按8字节对齐，开头是uint32_t kind和uint32_t aux：
+     *     null/bool/int   值直接放在aux中
+     *     double          后面跟着8字节的double
+     *     string          后面跟着uint64_t长度、字符串内容和一个'\0'
+     *     array           后面跟着uint64_t个数和每个元素的偏移
+     *     object          后面跟着uint64_t个数和每个成员的{键的偏移, 值的偏移}，按键排好序
+     * 对象的键和字符串节点的布局相同
+     * 所有偏移都是相对于快照开头的，数值按写入机器的字节序保存
+     */
+    static const char snapshot_magic[8] = {'T', 'J', 'S', 'N', 'A', 'P', '0', '1'};
+    static const uint32_t snapshot_byte_order = 0x01020304;
+    static const uint64_t snapshot_header_size = 32;
+
+    enum SnapshotKind : uint32_t{
+        SNAP_NULL, SNAP_BOOL, SNAP_INT, SNAP_DOUBLE, SNAP_STRING, SNAP_ARRAY, SNAP_OBJECT
+    };
+
+    struct SnapshotWriter{
+        string& out;
+
+        template<class T>
+        void put(T value){
+            out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        void align(){
+            out.append((8 - out.size() % 8) % 8, '\0');
+        }
+
+        uint64_t write_string(std::string_view str){
+            align();
+            const uint64_t offset = out.size();
+            put<uint32_t>(SNAP_STRING);
+            put<uint32_t>(0);
+            put<uint64_t>(str.size());
+            out += str;
+            out += '\0';
+            return offset;
+        }
+
+        // 先写子节点再写父节点，这样父节点写入时已经知道所有子节点的偏移
+        uint64_t write(const Json& json){
+            uint64_t offset;
+            switch(json.type()){
+                case Json::NUL:
+                    align();
+                    offset = out.size();
+                    put<uint32_t>(SNAP_NULL);
+                    put<uint32_t>(0);
+                    return offset;
+                case Json::BOOL:
+                    align();
+                    offset = out.size();
+                    put<uint32_t>(SNAP_BOOL);
+                    put<uint32_t>(json.bool_value() ? 1 : 0);
+                    return offset;
+                case Json::NUMBER:
+                    align();
+                    offset = out.size();
+                    if(json.stores_integer()){
+                        put<uint32_t>(SNAP_INT);
+                        put<int32_t>(json.int_value());
+                    }
+                    else{
+                        put<uint32_t>(SNAP_DOUBLE);
+                        put<uint32_t>(0);
+                        put<double>(json.number_value());
+                    }
+                    return offset;
+                case Json::STRING:
+                    return write_string(json.string_view_value());
+                case Json::ARRAY:{
+                    vector<uint64_t> children;
+                    children.reserve(json.array_items().size());
+                    for(const auto& item : json.array_items()){
+                        children.push_back(write(item));
+                    }
+                    align();
+                    offset = out.size();
+                    put<uint32_t>(SNAP_ARRAY);
+                    put<uint32_t>(0);
+                    put<uint64_t>(children.size());
+                    for(uint64_t child : children){
+                        put<uint64_t>(child);
+                    }
+                    return offset;
+                }
+                case Json::OBJECT:{
+                    // ObjectMembers按键的顺序遍历
+                    const ObjectMembers items(json);
+                    vector<std::pair<uint64_t, uint64_t>> members;
+                    members.reserve(items.size());
+                    for(const auto& kv : items){
+                        const uint64_t key = write_string(kv.first);
+                        members.emplace_back(key, write(kv.second));
+                    }
+                    align();
+                    offset = out.size();
+                    put<uint32_t>(SNAP_OBJECT);
+                    put<uint32_t>(0);
+                    put<uint64_t>(members.size());
+                    for(const auto& member : members){
+                        put<uint64_t>(member.first);
+                        put<uint64_t>(member.second);
+                    }
+                    return offset;
+                }
+            }
+            return 0;
+        }
+    };
+
+    void Json::write_snapshot(string& out) const {
+        const size_t start = out.size();
+        string body;
+        SnapshotWriter writer {body};
+        writer.put<uint64_t>(0);
+        writer.put<uint64_t>(0);
+        writer.put<uint64_t>(0);
+        writer.put<uint64_t>(0);
+        const uint64_t root = writer.write(*this);
+        writer.align();
+
+        const uint64_t size = body.size();
+        memcpy(&body[0], snapshot_magic, sizeof(snapshot_magic));
+        memcpy(&body[8], &snapshot_byte_order, sizeof(snapshot_byte_order));
+        memcpy(&body[16], &root, sizeof(root));
+        memcpy(&body[24], &size, sizeof(size));
+        if(start == 0){
+            out = move(body);
+        }
+        else{
+            out += body;
+        }
+    }
+
+    /*
+     * JsonView
+     * 每次读取都检查偏移是否越界，损坏的快照只会读出默认值
+     * 写入时子节点总在父节点之前，偏移不小于父节点的子节点一定是损坏的，这样也不会绕回祖先形成环
+     */
+    template<class T>
+    static inline bool snapshot_read(const char* base, uint64_t size, uint64_t offset, T& value){
+        if(offset > size || size - offset < sizeof(T)){
+            return false;
+        }
+        memcpy(&value, base + offset, sizeof(T));
+        return true;
+    }
+
+    static inline uint32_t snapshot_kind(const char* base, uint64_t size, uint64_t offset){
+        uint32_t kind;
+        if(!base || !snapshot_read(base, size, offset, kind) || kind > SNAP_OBJECT){
+            return SNAP_NULL;
+        }
+        return kind;
+    }
+
+    static inline std::string_view snapshot_string(const char* base, uint64_t size, uint64_t offset){
+        uint64_t length;
+        if(!snapshot_read(base, size, offset + 8, length) || length > size - offset - 16){
+            return std::string_view();
+        }
+        return std::string_view(base + offset + 16, static_cast<size_t>(length));
+    }
+
+    Json::Type JsonView::type() const {
+        switch(snapshot_kind(m_base, m_size, m_offset)){
+            case SNAP_BOOL:
+                return Json::BOOL;
+            case SNAP_INT:
+            case SNAP_DOUBLE:
+                return Json::NUMBER;
+            case SNAP_STRING:
+                return Json::STRING;
+            case SNAP_ARRAY:
+                return Json::ARRAY;
+            case SNAP_OBJECT:
+                return Json::OBJECT;
+            default:
+                return Json::NUL;
+        }
+    }
+
+    double JsonView::number_value() const {
+        const uint32_t kind = snapshot_kind(m_base, m_size, m_offset);
+        if(kind == SNAP_INT){
+            return int_value();
+        }
+        double value = 0;
+        if(kind == SNAP_DOUBLE){
+            snapshot_read(m_base, m_size, m_offset + 8, value);
+        }
+        return value;
+    }
+
+    int JsonView::int_value() const {
+        const uint32_t kind = snapshot_kind(m_base, m_size, m_offset);
+        if(kind == SNAP_DOUBLE){
+            return static_cast<int>(number_value());
+        }
+        int32_t value = 0;
+        if(kind == SNAP_INT){
+            snapshot_read(m_base, m_size, m_offset + 4, value);
+        }
+        return value;
+    }
+
+    bool JsonView::bool_value() const {
+        uint32_t value = 0;
+        if(snapshot_kind(m_base, m_size, m_offset) == SNAP_BOOL){
+            snapshot_read(m_base, m_size, m_offset + 4, value);
+        }
+        return value != 0;
+    }
+
+    std::string_view JsonView::string_value() const {
+        if(snapshot_kind(m_base, m_size, m_offset) != SNAP_STRING){
+            return std::string_view();
+        }
+        return snapshot_string(m_base, m_size, m_offset);
+    }
+
+    size_t JsonView::size() const {
+        const uint32_t kind = snapshot_kind(m_base, m_size, m_offset);
+        uint64_t count = 0;
+        if(kind == SNAP_ARRAY || kind == SNAP_OBJECT){
+            snapshot_read(m_base, m_size, m_offset + 8, count);
+            // 个数与剩下的字节数对不上时按空容器处理
+            const uint64_t entry = kind == SNAP_ARRAY ? 8 : 16;
+            if(count > (m_size - m_offset - 16) / entry){
+                count = 0;
+            }
+        }
+        return static_cast<size_t>(count);
+    }
+
+    JsonView JsonView::operator[](size_t i) const {
+        uint64_t child;
+        if(snapshot_kind(m_base, m_size, m_offset) != SNAP_ARRAY || i >= size()
+           || !snapshot_read(m_base, m_size, m_offset + 16 + i * 8, child) || child >= m_offset){
+            return JsonView();
+        }
+        return JsonView(m_base, m_size, child);
+    }
+
+    JsonView JsonView::iterator::operator*() const {
+        return JsonView(m_base, m_size, m_offset)[m_i];
+    }
+
+    JsonView::Items JsonView::array_items() const {
+        iterator first;
+        first.m_base = m_base;
+        first.m_size = m_size;
+        first.m_offset = m_offset;
+        first.m_i = 0;
+        iterator last = first;
+        last.m_i = is_array() ? size() : 0;
+        return Items{first, last};
+    }
+
+    std::string_view JsonView::key_at(size_t i) const {
+        uint64_t key;
+        if(snapshot_kind(m_base, m_size, m_offset) != SNAP_OBJECT || i >= size()
+           || !snapshot_read(m_base, m_size, m_offset + 16 + i * 16, key) || key >= m_offset){
+            return std::string_view();
+        }
+        return snapshot_string(m_base, m_size, key);
+    }
+
+    JsonView JsonView::value_at(size_t i) const {
+        uint64_t value;
+        if(snapshot_kind(m_base, m_size, m_offset) != SNAP_OBJECT || i >= size()
+           || !snapshot_read(m_base, m_size, m_offset + 16 + i * 16 + 8, value) || value >= m_offset){
+            return JsonView();
+        }
+        return JsonView(m_base, m_size, value);
+    }
+
+    JsonView JsonView::operator[](std::string_view key) const {
+        if(snapshot_kind(m_base, m_size, m_offset) != SNAP_OBJECT){
+            return JsonView();
+        }
+        // 键的顺序与std::map<std::string, Json>相同，也就是按字节比较
+        size_t lower = 0, upper = size();
+        while(lower < upper){
+            const size_t middle = lower + (upper - lower) / 2;
+            const int cmp = key_at(middle).compare(key);
+            if(cmp == 0){
+                return value_at(middle);
+            }
+            if(cmp < 0){
+                lower = middle + 1;
+            }
+            else{
+                upper = middle;
+            }
+        }
+        return JsonView();
+    }
+
+    Json JsonView::to_json() const {
+        switch(snapshot_kind(m_base, m_size, m_offset)){
+            case SNAP_BOOL:
+                return bool_value();
+            case SNAP_INT:
+                return int_value();
+            case SNAP_DOUBLE:
+                return number_value();
+            case SNAP_STRING:
+                return string(string_value());
+            case SNAP_ARRAY:{
+                Json::array data;
+                data.reserve(size());
+                for(auto item : array_items()){
+                    data.push_back(item.to_json());
+                }
+                return Json(move(data));
+            }
+            case SNAP_OBJECT:{
+                Json::object data;
+                const size_t n = size();
+                for(size_t i = 0; i < n; i++){
+                    data.emplace_hint(data.end(), string(key_at(i)), value_at(i).to_json());
+                }
+                return Json(move(data));
+            }
+            default:
+                return Json();
+        }
+    }
+
+    /*
+     * JsonSnapshot
+     */
+    bool JsonSnapshot::check_header(string& err){
+        uint32_t byte_order = 0;
+        uint64_t size = 0;
+        if(m_size < snapshot_header_size || memcmp(m_data, snapshot_magic, sizeof(snapshot_magic)) != 0){
+            err = "not a json snapshot";
+            return false;
+        }
+        memcpy(&byte_order, m_data + 8, sizeof(byte_order));
+        memcpy(&size, m_data + 24, sizeof(size));
+        if(byte_order != snapshot_byte_order){
+            err = "json snapshot was written with a different byte order";
+            return false;
+        }
+        if(size > m_size){
+            err = "truncated json snapshot";
+            return false;
+        }
+        m_size = size;
+        return true;
+    }
+
+    std::shared_ptr<JsonSnapshot> JsonSnapshot::from_buffer(string bytes, string& err){
+        std::shared_ptr<JsonSnapshot> snapshot(new JsonSnapshot());
+        snapshot->m_buffer = move(bytes);
+        snapshot->m_data = snapshot->m_buffer.data();
+        snapshot->m_size = snapshot->m_buffer.size();
+        if(!snapshot->check_header(err)){
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    std::shared_ptr<JsonSnapshot> JsonSnapshot::open(const string& path, string& err){
+#ifdef _WIN32
+        // Windows下没有mmap，退化为整个读进内存
+        std::ifstream file(path, std::ios::binary);
+        if(!file){
+            err = "cannot open " + path;
+            return nullptr;
+        }
+        string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return from_buffer(move(bytes), err);
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            err = "cannot open " + path;
+            return nullptr;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size <= 0){
+            ::close(fd);
+            err = "cannot read " + path;
+            return nullptr;
+        }
+        const size_t length = static_cast<size_t>(info.st_size);
+        void* data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        // 映射建立之后文件描述符就不再需要了
+        ::close(fd);
+        if(data == MAP_FAILED){
+            err = "cannot mmap " + path;
+            return nullptr;
+        }
+        std::shared_ptr<JsonSnapshot> snapshot(new JsonSnapshot());
+        snapshot->m_data = static_cast<const char*>(data);
+        snapshot->m_size = length;
+        snapshot->m_mapped = length;
+        if(!snapshot->check_header(err)){
+            return nullptr;
+        }
+        return snapshot;
+#endif
+    }
+
+    JsonSnapshot::~JsonSnapshot(){
+#ifndef _WIN32
+        if(m_mapped){
+            munmap(const_cast<char*>(m_data), m_mapped);
+        }
+#endif
+    }
+
+    JsonView JsonSnapshot::root() const {
+        uint64_t root = 0;
+        memcpy(&root, m_data + 16, sizeof(root));
+        return JsonView(m_data, m_size, root);
+    }
+    /*
+     * JSON Pointer（RFC 6901）
+     * 把"/a/b~1c"拆成{"a", "b/c"}，~1表示'/'，~0表示'~'
+     * 格式不对时返回false
+     */
+    static bool split_pointer(const string& path, vector<string>& tokens){
+        tokens.clear();
+        if(path.empty()){
+            return true;
+        }
+        if(path[0] != '/'){
+            return false;
+        }
+        string token;
+        for(size_t i = 1; i <= path.size(); i++){
+            if(i == path.size() || path[i] == '/'){
+                tokens.push_back(move(token));
+                token.clear();
+            }
+            else if(path[i] == '~'){
+                if(i + 1 == path.size() || (path[i + 1] != '0' && path[i + 1] != '1')){
+                    return false;
+                }
+                token += path[++i] == '0' ? '~' : '/';
+            }
+            else{
+                token += path[i];
+            }
+        }
+        return true;
+    }
+
+    // 数组下标只能是没有前导0的十进制数，"-"表示末尾之后的位置
+    static bool parse_index(const string& token, size_t size, size_t& index){
+        if(token == "-"){
+            index = size;
+            return true;
+        }
+        if(token.empty() || token.size() > 18 || (token[0] == '0' && token.size() > 1)){
+            return false;
+        }
+        index = 0;
+        for(char ch : token){
+            if(!in_range(ch, '0', '9')){
+                return false;
+            }
+            index = index * 10 + static_cast<size_t>(ch - '0');
+        }
+        return true;
+    }
+
+    /*
+     * 持久化更新
+     * result先和原来的Json共享根节点，沿着path往下用写时复制的修改接口
+     * 共享的节点会被浅拷贝，所以只复制路径上的节点，兄弟子树仍然共享
+     * 先在原来的Json上检查整条路径，不合法时还没有复制任何节点
+     */
+    Json Json::with(const string& path, Json value) const {
+        vector<string> tokens;
+        if(!split_pointer(path, tokens)){
+            return *this;
+        }
+        // 不存在的键和追加的位置在修改时都是null，之后的token会把它变成object
+        const Json* current = this;
+        for(const string& token : tokens){
+            if(current->is_array()){
+                const size_t size = current->array_items().size();
+                size_t index;
+                if(!parse_index(token, size, index) || index > size){
+                    return *this;
+                }
+                current = &(*current)[index];
+            }
+            else if(current->is_object() || current->is_null()){
+                current = &(*current)[token];
+            }
+            else{
+                return *this;
+            }
+        }
+
+        Json result = *this;
+        Json* target = &result;
+        for(const string& token : tokens){
+            if(target->is_array()){
+                size_t index;
+                if(!parse_index(token, target->array_items().size(), index)){
+                    return *this;
+                }
+                target = target->child_mut(index);
+            }
+            else{
+                target = target->child_mut(token);
+            }
+            if(!target){
+                return *this;
+            }
+        }
+        *target = move(value);
+        return result;
+    }
+    /*
+     * JSON Patch
+     */
+    static string escape_pointer_token(const string& token){
+        string out;
+        for(char ch : token){
+            if(ch == '~'){
+                out += "~0";
+            }
+            else if(ch == '/'){
+                out += "~1";
+            }
+            else{
+                out += ch;
+            }
+        }
+        return out;
+    }
+
+    static void diff_values(const Json& from, const Json& to, string& path, Json::array& ops){
+        if(from.type() != to.type()){
+            ops.push_back(Json::object{{"op", "replace"}, {"path", path}, {"value", to}});
+            return;
+        }
+        const size_t path_size = path.size();
+        if(from.is_object()){
+            const ObjectMembers a(from), b(to);
+            // 同一个节点，整棵子树都没有变化
+            if(a.same_node(b)){
+                return;
+            }
+            // 两边的键都是有序的，一起往前走
+            auto ia = a.begin();
+            auto ib = b.begin();
+            while(ia != a.end() || ib != b.end()){
+                if(ib == b.end() || (ia != a.end() && ia->first < ib->first)){
+                    ops.push_back(Json::object{{"op", "remove"}, {"path", path + "/" + escape_pointer_token(ia->first)}});
+                    ++ia;
+                }
+                else if(ia == a.end() || ib->first < ia->first){
+                    ops.push_back(Json::object{{"op", "add"}, {"path", path + "/" + escape_pointer_token(ib->first)}, {"value", ib->second}});
+                    ++ib;
+                }
+                else{
+                    path += "/" + escape_pointer_token(ia->first);
+                    diff_values(ia->second, ib->second, path, ops);
+                    path.resize(path_size);
+                    ++ia;
+                    ++ib;
+                }
+            }
+        }
+        else if(from.is_array()){
+            const Json::array& a = from.array_items();
+            const Json::array& b = to.array_items();
+            if(&a == &b){
+                return;
+            }
+            const size_t common = std::min(a.size(), b.size());
+            for(size_t i = 0; i < common; i++){
+                path += "/" + std::to_string(i);
+                diff_values(a[i], b[i], path, ops);
+                path.resize(path_size);
+            }
+            for(size_t i = common; i < b.size(); i++){
+                ops.push_back(Json::object{{"op", "add"}, {"path", path + "/" + std::to_string(i)}, {"value", b[i]}});
+            }
+            // 从后往前删，前面的下标才不会变
+            for(size_t i = a.size(); i > common; i--){
+                ops.push_back(Json::object{{"op", "remove"}, {"path", path + "/" + std::to_string(i - 1)}});
+            }
+        }
+        else if(from != to){
+            ops.push_back(Json::object{{"op", "replace"}, {"path", path}, {"value", to}});
+        }
+    }
+
+    Json Json::diff(const Json& from, const Json& to){
+        Json::array ops;
+        string path;
+        diff_values(from, to, path, ops);
+        return Json(move(ops));
+    }
+
+    // 补丁和合并只在一次调用内部使用子节点的指针，不需要让节点停止缓存哈希
+    struct ChildAccess{
+        static Json* get(Json& json, const string& key) { return json.child_mut(key); }
+        static Json* get(Json& json, size_t i) { return json.child_mut(i); }
+    };
+
+    // 按tokens的前count个查找，不存在时返回nullptr
+    static const Json* find_pointer(const Json& root, const vector<string>& tokens, size_t count){
+        const Json* current = &root;
+        for(size_t k = 0; k < count; k++){
+            if(current->is_object()){
+                const Json* value = ObjectMembers(*current).find(tokens[k]);
+                if(!value){
+                    return nullptr;
+                }
+                current = value;
+            }
+            else if(current->is_array()){
+                const size_t size = current->array_items().size();
+                size_t index;
+                if(!parse_index(tokens[k], size, index) || index >= size){
+                    return nullptr;
+                }
+                current = &current->array_items()[index];
+            }
+            else{
+                return nullptr;
+            }
+        }
+        return current;
+    }
+
+    // 与find_pointer()相同，但是沿途的节点会被分离出来以便修改
+    static Json* mutable_pointer(Json& root, const vector<string>& tokens, size_t count){
+        Json* current = &root;
+        for(size_t k = 0; k < count; k++){
+            if(current->is_object()){
+                if(!ObjectMembers(*current).find(tokens[k])){
+                    return nullptr;
+                }
+                current = ChildAccess::get(*current, tokens[k]);
+            }
+            else if(current->is_array()){
+                const size_t size = current->array_items().size();
+                size_t index;
+                if(!parse_index(tokens[k], size, index) || index >= size){
+                    return nullptr;
+                }
+                current = ChildAccess::get(*current, index);
+            }
+            else{
+                return nullptr;
+            }
+        }
+        return current;
+    }
+
+    static bool patch_add(Json& doc, const vector<string>& tokens, Json value){
+        if(tokens.empty()){
+            doc = move(value);
+            return true;
+        }
+        Json* parent = mutable_pointer(doc, tokens, tokens.size() - 1);
+        if(!parent){
+            return false;
+        }
+        if(parent->is_object()){
+            parent->set(tokens.back(), move(value));
+            return true;
+        }
+        if(parent->is_array()){
+            size_t index;
+            if(!parse_index(tokens.back(), parent->array_items().size(), index)
+               || index > parent->array_items().size()){
+                return false;
+            }
+            parent->insert(index, move(value));
+            return true;
+        }
+        return false;
+    }
+
+    static bool patch_remove(Json& doc, const vector<string>& tokens){
+        if(tokens.empty()){
+            return false;
+        }
+        Json* parent = mutable_pointer(doc, tokens, tokens.size() - 1);
+        if(!parent){
+            return false;
+        }
+        if(parent->is_object()){
+            return parent->erase(tokens.back());
+        }
+        size_t index;
+        return parent->is_array()
+               && parse_index(tokens.back(), parent->array_items().size(), index)
+               && parent->erase(index);
+    }
+
+    Json Json::apply_patch(const Json& patch, string& err) const {
+        if(!patch.is_array()){
+            err = "patch must be an array";
+            return *this;
+        }
+        Json result = *this;
+        vector<string> tokens;
+        vector<string> from_tokens;
+        for(size_t n = 0; n < patch.array_items().size(); n++){
+            const Json& operation = patch.array_items()[n];
+            const string& op = operation["op"].string_value();
+            const string& path = operation["path"].string_value();
+            const string prefix = "patch operation " + std::to_string(n) + " (" + op + "): ";
+            if(!operation["path"].is_string() || !split_pointer(path, tokens)){
+                err = prefix + "invalid path";
+                return *this;
+            }
+
+            bool ok;
+            if(op == "add" || op == "replace" || op == "test"){
+                if(!ObjectMembers(operation).find("value")){
+                    err = prefix + "missing value";
+                    return *this;
+                }
+                const Json& value = operation["value"];
+                if(op == "add"){
+                    ok = patch_add(result, tokens, value);
+                }
+                else if(op == "replace"){
+                    Json* target = mutable_pointer(result, tokens, tokens.size());
+                    if((ok = target != nullptr)){
+                        *target = value;
+                    }
+                }
+                else{
+                    const Json* target = find_pointer(result, tokens, tokens.size());
+                    ok = target && *target == value;
+                }
+            }
+            else if(op == "remove"){
+                ok = patch_remove(result, tokens);
+            }
+            else if(op == "move" || op == "copy"){
+                const string& from = operation["from"].string_value();
+                if(!operation["from"].is_string() || !split_pointer(from, from_tokens)){
+                    err = prefix + "invalid from";
+                    return *this;
+                }
+                const Json* source = find_pointer(result, from_tokens, from_tokens.size());
+                // 不能把一个节点移动到它自己的子节点中
+                const bool into_itself = op == "move" && from_tokens.size() < tokens.size()
+                                         && std::equal(from_tokens.begin(), from_tokens.end(), tokens.begin());
+                ok = source && !into_itself;
+                if(ok){
+                    Json value = *source;
+                    ok = (op == "copy" || patch_remove(result, from_tokens))
+                         && patch_add(result, tokens, move(value));
+                }
+            }
+            else{
+                err = prefix + "unknown operation";
+                return *this;
+            }
+
+            if(!ok){
+                err = prefix + (op == "test" ? "test failed at " : "cannot apply at ") + path;
+                return *this;
+            }
+        }
+        return result;
+    }
+    /*
+     * JSON Merge Patch
+     */
+    static bool has_null_member(const Json& patch){
+        for(const auto& item : ObjectMembers(patch)){
+            if(item.second.is_null() || (item.second.is_object() && has_null_member(item.second))){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 把patches中的count个补丁按顺序合并到target
+    static void merge_into(Json& target, const Json* const* patches, size_t count){
+        // 不是object的补丁直接替换整个值，在它之前的补丁都不起作用
+        size_t start = 0;
+        for(size_t k = count; k > 0; k--){
+            if(!patches[k - 1]->is_object()){
+                target = *patches[k - 1];
+                start = k;
+                break;
+            }
+        }
+        if(start == count){
+            return;
+        }
+        if(!target.is_object()){
+            // 补丁里没有null的话合并的结果就是补丁本身，直接共享
+            if(count - start == 1 && !has_null_member(*patches[start])){
+                target = *patches[start];
+                return;
+            }
+            target = Json::object();
+        }
+        if(count - start == 1){
+            for(const auto& item : ObjectMembers(*patches[start])){
+                if(item.second.is_null()){
+                    target.erase(item.first);
+                }
+                else{
+                    const Json* value = &item.second;
+                    merge_into(*ChildAccess::get(target, item.first), &value, 1);
+                }
+            }
+            return;
+        }
+
+        // 多个补丁按键分组，每个键只往下走一次
+        map<string, vector<const Json*>> groups;
+        for(size_t k = start; k < count; k++){
+            for(const auto& item : ObjectMembers(*patches[k])){
+                groups[item.first].push_back(&item.second);
+            }
+        }
+        for(auto& group : groups){
+            const vector<const Json*>& values = group.second;
+            // 最后一个null把之前的结果都删掉了
+            size_t first = 0;
+            for(size_t k = values.size(); k > 0; k--){
+                if(values[k - 1]->is_null()){
+                    first = k;
+                    break;
+                }
+            }
+            if(first > 0){
+                target.erase(group.first);
+            }
+            if(first < values.size()){
+                merge_into(*ChildAccess::get(target, group.first), values.data() + first, values.size() - first);
+            }
+        }
+    }
+
+    /*
+     * 补丁可能就是目标中的一棵子树，比如t.merge_patch(t["a"])
+     * 先拷贝一份句柄，补丁的节点在合并期间一直存活，并且因为被共享，修改目标时会先分离而不是改到补丁
+     */
+    void Json::merge_patch(const Json& patch){
+        const Json hold = patch;
+        const Json* value = &hold;
+        merge_into(*this, &value, 1);
+    }
+
+    void Json::merge_patches(const vector<Json>& patches){
+        const vector<Json> holds = patches;
+        vector<const Json*> values;
+        values.reserve(holds.size());
+        for(const Json& patch : holds){
+            values.push_back(&patch);
+        }
+        merge_into(*this, values.data(), values.size());
+    }
+    /*
+     * 内存占用
+     * seen不为空时记录已经计算过的节点，共享的子树只计算一次
+     */
+    struct MemoryCounter{
+        // 已经计算过的节点，以及形状这样由多个节点共享的数据
+        std::unordered_set<const void*>* seen;
+
+        bool first_visit(const void* data){
+            return !seen || seen->insert(data).second;
+        }
+
+        size_t value(const Json& json){
+            if(json.m_kind != Json::HEAP){
+                return 0;
+            }
+            const JsonValue* node = json.m_ptr;
+            if(!first_visit(node)){
+                return 0;
+            }
+            size_t total = node->own_memory();
+            if(const DumpCache* cache = node->m_dump_cache.load(std::memory_order_acquire)){
+                total += sizeof(DumpCache);
+                for(const auto& slot : cache->slots){
+                    if(const string* cached = slot.load(std::memory_order_acquire)){
+                        total += sizeof(string) + cached->capacity();
+                    }
+                }
+            }
+            const Json::Type type = node->type();
+            if(type == Json::ARRAY){
+                // 连续保存的数字没有子节点，也不需要生成Json::array
+                if(!dynamic_cast<const JsonNumberArray<double>*>(node) && !dynamic_cast<const JsonNumberArray<int>*>(node)){
+                    for(const Json& item : node->array_items()){
+                        total += value(item);
+                    }
+                }
+            }
+            else if(type == Json::OBJECT){
+                // 按形状保存的对象不需要生成map
+                if(const JsonShapedObject* shaped = dynamic_cast<const JsonShapedObject*>(node)){
+                    if(first_visit(shaped->m_shape.get())){
+                        total += shaped->m_shape->memory();
+                    }
+                    for(const Json& item : shaped->m_value){
+                        total += value(item);
+                    }
+                }
+                else{
+                    for(const auto& item : node->object_items()){
+                        total += value(item.second);
+                    }
+                }
+            }
+            else if(const JsonBorrowedString* borrowed = dynamic_cast<const JsonBorrowedString*>(node)){
+                // 引用的输入和普通节点一样，只在第一次遇到时计算
+                total += value(borrowed->m_buffer);
+            }
+            return total;
+        }
+    };
+
+    size_t Json::memory_usage(bool count_shared_once) const {
+        std::unordered_set<const void*> seen;
+        MemoryCounter counter{count_shared_once ? &seen : nullptr};
+        return counter.value(*this);
+    }
 }
\ No newline at end of file
@@ -3,10 +3,20 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory_resource>
 // 智能指针所在的头文件
 #include <memory>
 // 初始化列表
 #include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <cstdio>
+#include <cstring>
+#include <iosfwd>
+#include <atomic>
+#include <string_view>
+// std::hash
+#include <functional>
 
 /*
  * 用户检查VS的版本
@@ -32,6 +42,296 @@ namespace json11{
         STANDARD, COMMENTS
     };
 
+    /*
+     * 序列化的输出目标
+     * 内部维护一段可写的缓冲区[m_cur, m_end)
+     * 写入时只要放得下就直接拷贝，放不下才调用子类的overflow()
+     * 这样大多数写入都不需要虚函数调用
+     */
+    class JsonSink{
+    public:
+        virtual ~JsonSink() {}
+
+        void write(const char* data, size_t n){
+            if(static_cast<size_t>(m_end - m_cur) >= n){
+                memcpy(m_cur, data, n);
+                m_cur += n;
+            }
+            else{
+                overflow(data, n);
+            }
+        }
+        void write(const std::string& data){
+            write(data.data(), data.size());
+        }
+        void put(char ch){
+            if(m_cur != m_end){
+                *m_cur++ = ch;
+            }
+            else{
+                overflow(&ch, 1);
+            }
+        }
+
+        // 把缓冲区中还没交出去的内容全部写出
+        virtual void flush() {}
+
+    protected:
+        // 缓冲区放不下data时调用，子类负责腾出空间或者直接把data写出去
+        virtual void overflow(const char* data, size_t n) = 0;
+
+        char* m_cur = nullptr;
+        char* m_end = nullptr;
+    };
+
+    /*
+     * 输出到std::string
+     * 直接把string本身当作缓冲区，按倍数扩容
+     * 写入过程中string的尾部可能有多余的空间，flush()或析构之后才是最终结果
+     */
+    class StringSink final : public JsonSink{
+    public:
+        explicit StringSink(std::string& out);
+        ~StringSink() override;
+        void flush() override;
+        // 预留至少n字节的可写空间，之后n字节以内的写入都不会再扩容
+        void reserve(size_t n);
+
+    protected:
+        void overflow(const char* data, size_t n) override;
+
+    private:
+        std::string& m_out;
+    };
+
+    /*
+     * 只统计字节数，不保存内容
+     * 小块写入先落到一段临时缓冲区里，大块写入直接计数
+     */
+    class CountingSink final : public JsonSink{
+    public:
+        CountingSink();
+        size_t size() const { return m_counted + static_cast<size_t>(m_cur - m_scratch); }
+
+    protected:
+        void overflow(const char* data, size_t n) override;
+
+    private:
+        char m_scratch[256];
+        size_t m_counted = 0;
+    };
+
+    /*
+     * 输出到调用者提供的定长缓冲区
+     * 写不下时不会越界，只记录溢出，required()给出完整输出需要的字节数
+     */
+    class FixedBufferSink final : public JsonSink{
+    public:
+        FixedBufferSink(char* buffer, size_t capacity);
+
+        size_t size() const { return static_cast<size_t>(m_cur - m_begin); }
+        size_t required() const { return size() + m_dropped; }
+        bool overflowed() const { return m_dropped != 0; }
+
+    protected:
+        void overflow(const char* data, size_t n) override;
+
+    private:
+        char* m_begin;
+        size_t m_dropped = 0;
+    };
+
+    /*
+     * 带缓冲的输出
+     * 先写进固定大小的块，写满一块再交给write_out()
+     * 这样导出很大的数据时内存占用是有上限的
+     */
+    class BufferedSink : public JsonSink{
+    public:
+        static const size_t default_chunk_size = 64 * 1024;
+
+        void flush() override;
+        // 底层写出是否出过错
+        bool good() const { return m_good; }
+
+    protected:
+        explicit BufferedSink(size_t chunk_size);
+        void overflow(const char* data, size_t n) override;
+        // 把data真正写到目标中，失败时返回false
+        virtual bool write_out(const char* data, size_t n) = 0;
+
+    private:
+        std::unique_ptr<char[]> m_chunk;
+        size_t m_chunk_size;
+        bool m_good = true;
+    };
+
+    // 输出到C标准库的FILE*
+    class FileSink final : public BufferedSink{
+    public:
+        explicit FileSink(FILE* file, size_t chunk_size = default_chunk_size);
+        ~FileSink() override;
+
+    protected:
+        bool write_out(const char* data, size_t n) override;
+
+    private:
+        FILE* m_file;
+    };
+
+    // 输出到文件描述符，比如socket或者管道
+    class FdSink final : public BufferedSink{
+    public:
+        explicit FdSink(int fd, size_t chunk_size = default_chunk_size);
+        ~FdSink() override;
+
+    protected:
+        bool write_out(const char* data, size_t n) override;
+
+    private:
+        int m_fd;
+    };
+
+    // 输出到std::ostream
+    class OStreamSink final : public BufferedSink{
+    public:
+        explicit OStreamSink(std::ostream& stream, size_t chunk_size = default_chunk_size);
+        ~OStreamSink() override;
+
+    protected:
+        bool write_out(const char* data, size_t n) override;
+
+    private:
+        std::ostream& m_stream;
+    };
+
+    /*
+     * 序列化选项
+     * 所有风格都走同一个序列化器，区别只在于分隔符和换行缩进
+     */
+    struct DumpOptions{
+        enum Style{
+            // 与原来的输出一致：数组元素之间是", "，对象成员之间是","，键值之间是": "
+            DEFAULT,
+            // 不输出任何多余的空白，体积最小
+            COMPACT,
+            // 换行并按层级缩进，方便阅读
+            PRETTY
+        };
+
+        Style style = DEFAULT;
+        // PRETTY模式下每一层缩进的空格数
+        int indent = 4;
+        // 把所有非ASCII字符都转义成\uXXXX，输出只包含ASCII
+        bool ascii_only = false;
+        /*
+         * 大于1时，根节点是足够大的数组或对象的话会分段交给多个线程序列化
+         * 每个线程写自己的缓冲区，最后按顺序拼接，结果与单线程完全一致
+         */
+        unsigned threads = 1;
+        // 子节点少于这个数时不值得开线程
+        size_t parallel_min_items = 1024;
+        /*
+         * dump(std::string&)先用dump_size()量出准确长度，只分配一次内存
+         * 代价是整棵树要序列化两遍，通常比string扩容更慢，只在内存紧张、不希望多占容量时打开
+         */
+        bool presize = false;
+    };
+
+    /*
+     * 解析选项
+     */
+    struct ParseOptions{
+        JsonParse strategy = JsonParse::STANDARD;
+        /*
+         * 节点、数组和对象的存储、字符串的内容、lazy_numbers保存的原文和共享的形状都从这里分配
+         * nullptr表示使用默认的memory_resource
+         * 这样的字符串用string_view_value()读取不会分配，string_value()第一次调用时在全局堆上复制一份std::string
+         * 对象的键仍然是std::string，放不进string内部的长键由全局堆分配；borrow_strings引用的输入也不在这里
+         * 调用者要保证它比解析出来的Json活得更久
+         */
+        std::pmr::memory_resource* resource = nullptr;
+        /*
+         * 带小数或指数的数字（以及放不进int的整数）只保存原文，第一次读取时才转换
+         * dump()原样写回原文，不会因为格式化而改变精度或写法
+         * 放得进int的整数转换很快，仍然直接保存在Json中
+         */
+        bool lazy_numbers = false;
+        /*
+         * 解析出来的Json持有一份带引用计数的输入，没有转义的长字符串直接引用其中的一段
+         * 只要还有这样的字符串存活，整个输入就不会释放
+         * 这些字符串的string_value()第一次调用时才复制，只读取的话应使用string_view_value()
+         */
+        bool borrow_strings = false;
+        /*
+         * 键完全相同的对象共享同一份有序的键（形状），每个对象只保存值
+         * 适合由大量同构记录组成的数据，按键查找通过形状上的索引完成
+         * object_items()第一次调用时才生成std::map，修改时会先转换成普通的对象
+         */
+        bool share_shapes = false;
+        /*
+         * 解析时对表示完全相同的字符串、数组和对象只保留一份，后出现的直接引用先前的节点
+         * 1和1.0、0.0和-0.0虽然相等但写法不同，不会合并，开不开查重输出都一样
+         * 节点在修改前会先复制，所以共享是安全的
+         * 查重表在parse_multi()的多个文档之间共享，最多保存dedup_max_entries个节点
+         */
+        bool dedup = false;
+        size_t dedup_max_entries = 1 << 16;
+        /*
+         * 只包含一种数字的数组连续保存：全是整数时保存为int，全是浮点数时保存为double
+         * 可以通过number_span()和int_span()直接读取，dump()也直接从缓冲区写出
+         * array_items()和operator[]第一次调用时才生成Json::array，修改时会先转换成普通的数组
+         * 整数和浮点数混在一起的数组仍然是普通的数组
+         * lazy_numbers保存原文的数字不会放进这样的数组
+         */
+        bool typed_arrays = false;
+    };
+
+    /*
+     * 一段连续的只读数字，相当于C++20的std::span<const T>
+     */
+    template<class T>
+    struct NumberSpan{
+        const T* data = nullptr;
+        size_t size = 0;
+
+        const T* begin() const { return data; }
+        const T* end() const { return data + size; }
+        bool empty() const { return size == 0; }
+        const T& operator[](size_t i) const { return data[i]; }
+    };
+
+    // 序列化过程中的状态，定义在源文件中
+    struct DumpState;
+    // memoize_dump()保存的序列化结果，定义在源文件中
+    struct DumpCache;
+    // 生成二进制快照，定义在源文件中
+    struct SnapshotWriter;
+    // 计算memory_usage()，定义在源文件中
+    struct MemoryCounter;
+    // 按键的顺序遍历对象的成员，定义在源文件中
+    struct ObjectMembers;
+    // 补丁和合并在内部修改子节点，定义在源文件中
+    struct ChildAccess;
+    // Json解析器，定义在源文件中
+    struct JsonParser;
+
+    /*
+     * 全局统计，见Json::stats()
+     * 数组的下标是Json::Type；null、bool、整数和double保存在Json中，没有对应的节点
+     * NUMBER下记录的是解析时保留原文、延迟转换的数字
+     */
+    struct JsonStats{
+        // 程序启动以来创建过的节点数
+        size_t nodes_allocated[6];
+        // 当前还没有释放的节点数
+        size_t nodes_live[6];
+        // 存活节点本身占用的字节数（具体节点类的大小），不包括字符串和容器的缓冲区
+        size_t node_bytes_live;
+        // 所有序列化缓存占用的字节数
+        size_t dump_cache_bytes;
+    };
+
     /*
      * 类的提前声明
      * 这个类目前还没有实现
@@ -57,10 +357,16 @@ namespace json11{
          * 使用C++中的数据类型来存储Json数据
          * array对应vector
          * object对应map
+         * 使用std::pmr的容器，可以指定存储从哪个memory_resource分配，默认仍然是全局的new/delete
+         *
+         * 不兼容的改动：以前是std::vector<Json>和std::map<std::string, Json>
+         * 元素和接口都没有变，但类型不同了，绑定const std::vector<Json>&、按这两个类型传参或者返回的代码需要改用
+         * Json::array和Json::object，或者用迭代器复制一份：std::vector<Json>(a.begin(), a.end())
+         * 从std::vector<Json>、std::map<std::string, Json>构造Json仍然可以，走下面的模板构造函数
          */
-        typedef std::vector<Json> array;
+        typedef std::pmr::vector<Json> array;
         // 不太明白为什么是string对应的Json
-        typedef std::map<std::string, Json> object;
+        typedef std::pmr::map<std::string, Json> object;
 
         // 构建不同Json值的方法
         Json() noexcept;
@@ -72,10 +378,37 @@ namespace json11{
         Json(const std::string& value);
         Json(std::string&& value);
         Json(const char* value);
+        Json(const array& values);
         Json(array&& values);
         Json(const object& values);
         Json(object&& values);
 
+        /*
+         * null、bool、int和double直接保存在Json里，不分配堆内存
+         * 字符串、数组和对象才是指向JsonValue的句柄
+         * 引用计数放在JsonValue内部，拷贝时只增加计数，不需要额外的控制块
+         * 通过at_mut()交出过子节点指针的节点不能共享，拷贝时复制一份，所以拷贝可能分配内存
+         */
+        Json(const Json& other);
+        Json(Json&& other) noexcept;
+        Json& operator=(const Json& other);
+        Json& operator=(Json&& other) noexcept;
+        ~Json();
+
+        /*
+         * 在这个作用域内由当前线程新建的节点使用非原子的引用计数
+         * 适合只在一个线程中构建和使用的文档，省掉原子操作和缓存行争用
+         * 这些节点（包括它们的拷贝）不能再交给其他线程
+         * 编译时定义JSON11_NONATOMIC_REFCOUNT则所有节点都使用非原子计数
+         */
+        class SingleThreadScope final{
+        public:
+            SingleThreadScope();
+            ~SingleThreadScope();
+            SingleThreadScope(const SingleThreadScope&) = delete;
+            SingleThreadScope& operator=(const SingleThreadScope&) = delete;
+        };
+
         /*
          * 原作者说是隐式构造函数？
          * 翻译：隐式构造函数，任何带有 to_json() 函数的东西
@@ -99,6 +432,22 @@ namespace json11{
                 int>::type = 0>
         Json(const V & v) : Json(array(v.begin(), v.end())) {}
 
+        /*
+         * 右值容器的版本，把元素逐个移动过来而不是拷贝
+         * 只接受右值，左值仍然走上面的const版本
+         */
+        template <class M, typename std::enable_if<
+                !std::is_reference<M>::value
+                && std::is_constructible<std::string, decltype(std::declval<M>().begin()->first)>::value
+                && std::is_constructible<Json, decltype(std::declval<M>().begin()->second)>::value,
+                int>::type = 0>
+        Json(M && m) : Json(object(std::make_move_iterator(m.begin()), std::make_move_iterator(m.end()))) {}
+        template <class V, typename std::enable_if<
+                !std::is_reference<V>::value
+                && std::is_constructible<Json, decltype(*std::declval<V>().begin())>::value,
+                int>::type = 0>
+        Json(V && v) : Json(array(std::make_move_iterator(v.begin()), std::make_move_iterator(v.end()))) {}
+
         /*
          * 避免指针类型被隐式转换成bool类型
          */
@@ -106,6 +455,7 @@ namespace json11{
 
         /*
          * 访问器函数，用于获取Json数据的类型
+         * 内联保存的值只需要判断标记，不需要虚函数调用
          */
         Type type() const;
 
@@ -128,26 +478,128 @@ namespace json11{
         bool bool_value() const;
 
         const std::string& string_value() const;
+        // 不需要复制就能得到的字符串内容，在这个Json存活期间有效
+        std::string_view string_view_value() const;
 
         const array& array_items() const;
         const object& object_items() const;
+        /*
+         * typed_arrays解析出来的数字数组的连续缓冲区，在这个Json存活期间有效
+         * 不是这样保存的（包括普通的数组）返回空的span
+         * int_span()只对全是整数的数组有效，number_span()只对全是浮点数的数组有效
+         */
+        NumberSpan<double> number_span() const;
+        NumberSpan<int> int_span() const;
 
         // 如果是一个array，返回arr[i]
         const Json& operator[](size_t i) const;
         // 如果是一个object，返回obj[key]
         const Json& operator[](const std::string& key) const;
 
+        /*
+         * 修改
+         * 写时复制：节点只被这一个Json引用时直接修改，否则先浅拷贝一份，子节点仍然共享
+         * 只有null会先变成空的object或array，其它类型不对的值不做任何修改，返回nullptr或false
+         * 修改会丢弃这个节点的序列化缓存
+         * operator[]始终是只读的，写入要通过下面这些名字不同的接口
+         * 调用过at_mut()的容器以后不再和拷贝共享，也不再缓存哈希和序列化结果，这样留下来的指针不会改到别的Json
+         */
+        // 返回可以修改的obj[key]，和std::map的operator[]一样会插入不存在的键；指针在下一次修改之前有效
+        Json* at_mut(const std::string& key);
+        // 返回可以修改的arr[i]，i等于size()时追加一个null，更大的下标返回nullptr
+        Json* at_mut(size_t i);
+        bool set(const std::string& key, Json value);
+        // 返回是否真的删除了，不是object或者没有这个键时不做任何修改
+        bool erase(const std::string& key);
+        // 删除数组中的第i个元素，不是array或者越界时不做任何修改
+        bool erase(size_t i);
+        bool push_back(Json value);
+        // pos超过末尾时插入到末尾
+        bool insert(size_t pos, Json value);
+
+        /*
+         * 持久化更新：返回把path处的值替换成value之后的新Json，原来的Json不变
+         * path是JSON Pointer（RFC 6901），比如"/servers/0/port"，""表示整个文档
+         * 只复制从根到path的这一条路径上的节点，其余子树与原来的Json共享
+         * 中间不存在的键会创建成object，数组下标只能小于等于数组的长度，等于长度或者"-"表示追加
+         * path不合法、下标更大或者要穿过数字、字符串这样的标量时返回原值
+         */
+        Json with(const std::string& path, Json value) const;
+
+        /*
+         * JSON Patch（RFC 6902）
+         * diff()生成把from变成to的补丁，是一个由操作组成的array
+         * 两边共享的子树（同一个节点）直接跳过，不需要逐个比较
+         * 数组按下标逐个比较，不寻找插入和删除的最优对齐
+         */
+        static Json diff(const Json& from, const Json& to);
+        /*
+         * 应用补丁，返回新的Json，只有补丁涉及的路径会被复制
+         * 支持add、remove、replace、move、copy和test
+         * 任何一个操作失败时返回原值并设置err，不会只应用一半
+         */
+        Json apply_patch(const Json& patch, std::string& err) const;
+
+        /*
+         * JSON Merge Patch（RFC 7396）
+         * patch中的null表示删除这个键，object递归合并，其它值直接替换
+         * 只被这一个Json引用的节点原地修改，补丁没有涉及的子树保持共享
+         */
+        void merge_patch(const Json& patch);
+        // 按顺序合并多个补丁，结果与逐个合并相同，但每个键只往下走一次
+        void merge_patches(const std::vector<Json>& patches);
+
         /*
          * 序列化
          * 也就是将数据结构转换为Json数据
          */
-        void dump(std::string& out) const;
-        std::string dump() const {
+        void dump(std::string& out, const DumpOptions& options = DumpOptions()) const;
+        // 输出到任意的JsonSink，调用者负责在最后flush()
+        void dump(JsonSink& out, const DumpOptions& options = DumpOptions()) const;
+        std::string dump(const DumpOptions& options = DumpOptions()) const {
             std::string out;
-            dump(out);
+            dump(out, options);
             return out;
         }
 
+        /*
+         * 序列化后的准确字节数，包括转义和数字的宽度
+         * 与dump()走同一个序列化器，所以结果一定一致
+         */
+        size_t dump_size(const DumpOptions& options = DumpOptions()) const;
+
+        /*
+         * 缓存这个节点序列化后的结果
+         * 同一个子树被嵌入很多文档时，之后的dump()直接拷贝缓存，修改这个节点会丢弃缓存
+         * 第一次序列化时才真正填充，多个线程同时填充是安全的
+         * PRETTY风格的输出与所在的层级有关，不使用缓存
+         */
+        void memoize_dump() const;
+        // 所有序列化缓存当前占用的字节数
+        static size_t dump_cache_bytes();
+
+        /*
+         * 这个Json在堆上占用的字节数，包括节点、字符串和容器的缓冲区以及序列化缓存
+         * 不包括Json句柄本身，内联保存的标量返回0
+         * borrow_strings引用的输入和share_shapes共享的形状也算在内
+         * count_shared_once为true时被多处引用的子树、输入和形状只计算一次，即实际占用的内存
+         * 否则按展开成一棵树来计算，每个引用它们的节点都算一份
+         */
+        size_t memory_usage(bool count_shared_once = false) const;
+
+        /*
+         * 结构哈希，与operator==一致：相等的int和double哈希相同，对象的成员与顺序无关
+         * 堆上节点的哈希在第一次计算后保存在节点中，修改时丢弃
+         * 通过at_mut()交出过子节点指针的节点不再缓存，因为子节点可能在它不知道的时候被修改
+         * 延迟转换的数字为了按数值计算会先转换
+         */
+        size_t hash() const;
+        /*
+         * 节点的创建和释放计数，使用relaxed原子操作
+         * 编译时定义JSON11_DISABLE_STATS则不计数，全部返回0
+         */
+        static JsonStats stats();
+
         /*
          * 解析
          * 如果解析失败，则返回 Json()并将错误消息分配给err
@@ -155,6 +607,13 @@ namespace json11{
         static Json parse(const std::string& in,
                           std::string& err,
                           JsonParse strategy = JsonParse::STANDARD);
+        static Json parse(const std::string& in,
+                          std::string& err,
+                          const ParseOptions& options);
+        // borrow_strings时直接接管输入，不再复制一份
+        static Json parse(std::string&& in,
+                          std::string& err,
+                          const ParseOptions& options);
         static Json parse(const char* in,
                           std::string& err,
                           JsonParse strategy = JsonParse::STANDARD){
@@ -178,6 +637,12 @@ namespace json11{
                 std::string& err,
                 JsonParse strategy = JsonParse::STANDARD
                 );
+        static std::vector<Json> parse_multi(
+                const std::string& in,
+                std::string::size_type& parser_stop_pos,
+                std::string& err,
+                const ParseOptions& options
+                );
         static inline std::vector<Json> parse_multi(
                 const std::string& in,
                 std::string& err,
@@ -186,6 +651,54 @@ namespace json11{
             return parse_multi(in, parser_stop_pos, err, strategy);
         }
 
+        /*
+         * MessagePack编码
+         * 整数和浮点数分开编码，解码之后仍然能区分int和double
+         */
+        void to_msgpack(std::string& out) const;
+        std::string to_msgpack() const {
+            std::string out;
+            to_msgpack(out);
+            return out;
+        }
+        /*
+         * MessagePack解码
+         * 失败时返回Json()并将错误消息分配给err
+         * Json中没有对应的bin和ext类型，遇到时按错误处理；对象的键必须是字符串
+         */
+        static Json from_msgpack(const std::string& in, std::string& err);
+
+        /*
+         * CBOR（RFC 8949）编码
+         * 长度都是确定的，整数和浮点数分开编码
+         */
+        void to_cbor(std::string& out) const;
+        std::string to_cbor() const {
+            std::string out;
+            to_cbor(out);
+            return out;
+        }
+        /*
+         * CBOR解码
+         * 支持不定长的字符串、数组和map，tag会被忽略，只保留其中的值
+         * 失败时返回Json()，err中包含出错的字节偏移
+         */
+        static Json from_cbor(const std::string& in, std::string& err);
+        /*
+         * 解码CBOR序列（RFC 8742），即首尾相接的多个CBOR数据
+         * 用于流式接收：parser_stop_pos是最后一个完整数据之后的位置
+         * 数据不完整时返回已解码的部分，剩下的字节等收到更多数据后再从parser_stop_pos继续
+         */
+        static std::vector<Json> from_cbor_multi(const std::string& in,
+                                                 std::string::size_type& parser_stop_pos,
+                                                 std::string& err);
+
+        /*
+         * 生成只读的二进制快照，见JsonSnapshot
+         * 快照中没有指针，只有相对于开头的偏移，可以直接mmap使用
+         */
+        void write_snapshot(std::string& out) const;
+
         bool operator==(const Json& rhs) const;
         bool operator< (const Json& rhs) const;
         bool operator!=(const Json& rhs) const { return !(*this == rhs); }
@@ -205,9 +718,49 @@ namespace json11{
         bool has_shape(const shape& types, std::string& err) const;
 
     private:
-        // 这个指针指向的是什么？
-        // 似乎是指需要解析的Json数据
-        std::shared_ptr<JsonValue> m_ptr;
+        friend struct DumpState;
+        friend struct SnapshotWriter;
+        friend struct MemoryCounter;
+        friend struct ObjectMembers;
+        friend struct ChildAccess;
+        friend struct JsonParser;
+
+        // 接管一个新建的节点
+        explicit Json(JsonValue* value) noexcept;
+        // 从resource中分配并构造一个节点，定义在源文件中
+        template<class Node, class... Args>
+        static Json make_node(std::pmr::memory_resource* resource, Args&&... args);
+        // 按m_kind拷贝联合体中有效的成员，不处理引用计数
+        void copy_from(const Json& other) noexcept;
+        // 是否以整数保存，二进制编码时需要区分
+        bool stores_integer() const;
+        // 取得可以修改的容器，必要时先分离出独占的节点；null先变成空容器，其它类型返回nullptr
+        object* mutable_object();
+        array* mutable_array();
+        // 与at_mut()相同，但不把节点标记为交出过子节点，只给不会把指针留下来的内部代码使用
+        Json* child_mut(const std::string& key);
+        Json* child_mut(size_t i);
+        /*
+         * 复制一个交出过子节点指针的容器，子节点仍然共享（交出过指针的子节点同样会被复制）
+         * 以后通过那些指针的修改只影响原来的节点，看不到复制出来的这一份
+         */
+        Json clone_lent() const;
+
+        // 值保存在哪里，只有HEAP才需要m_ptr
+        enum Kind : uint8_t{
+            INLINE_NULL, INLINE_BOOL, INLINE_INT, INLINE_DOUBLE, HEAP
+        };
+
+        union{
+            bool m_bool;
+            int m_int;
+            double m_double;
+            // 这个指针指向的是什么？
+            // 似乎是指需要解析的Json数据
+            // 只有m_kind为HEAP时有效，并且不为空
+            JsonValue* m_ptr;
+        };
+        Kind m_kind;
      };
 
 
@@ -219,21 +772,326 @@ namespace json11{
     protected:
         // 为什么使用的是友元？
         friend class Json;
-        friend class JsonInt;
-        friend class JsonDouble;
+        friend struct DumpState;
+        friend struct SnapshotWriter;
+        friend struct MemoryCounter;
+        friend struct ObjectMembers;
+
+        /*
+         * 引用计数的方式
+         * REF_ATOMIC：默认，可以在线程之间共享
+         * REF_LOCAL：在Json::SingleThreadScope中创建，只在一个线程中使用
+         */
+        enum RefMode : uint8_t{
+            REF_ATOMIC, REF_LOCAL
+        };
+
+        JsonValue();
+        void retain() const noexcept;
+        // 返回true表示刚刚释放的是最后一个引用
+        bool release() const noexcept;
+        // 析构并按分配时的方式归还内存
+        virtual void destroy() const noexcept = 0;
 
         virtual Json::Type type() const = 0;
-        virtual bool equals(const JsonValue* other) const = 0;
-        virtual bool less(const JsonValue* other) const = 0;
-        virtual void dump(std::string& out) const = 0;
+        // 只用于比较两个数组或两个对象，其它类型在Json中直接比较
+        virtual bool equals(const JsonValue* other) const;
+        virtual bool less(const JsonValue* other) const;
+        // 计算结构哈希，结果由Json::hash()缓存
+        virtual size_t compute_hash() const;
+        virtual void dump(DumpState& state) const = 0;
         virtual double number_value() const;
         virtual int int_value() const;
+        // 是否以整数保存，二进制编码时需要区分
+        virtual bool is_integer() const { return false; }
         virtual bool bool_value() const;
         virtual const std::string& string_value() const;
+        virtual std::string_view string_view_value() const { return string_value(); }
         virtual const Json::array& array_items() const;
         virtual const Json& operator[](size_t i) const;
         virtual const Json::object& object_items() const;
         virtual const Json& operator[](const std::string& key) const;
-        virtual ~JsonValue() {}
+        // 可以原地修改的容器，其它表示方式返回nullptr，修改前要先转换
+        virtual Json::array* mutable_array_items() { return nullptr; }
+        virtual Json::object* mutable_object_items() { return nullptr; }
+        // 节点本身和它直接拥有的缓冲区的字节数，不包括子节点
+        virtual size_t own_memory() const = 0;
+        virtual ~JsonValue();
+
+        mutable std::atomic<uint32_t> m_refs{0};
+        uint8_t m_ref_mode;
+        // 节点实际的大小，make_node()记录，统计和从memory_resource释放时要用到
+        uint16_t m_node_size = 0;
+        // at_mut()交出过子节点的指针，之后子节点可能被直接修改：拷贝时要复制，哈希和序列化结果不能再缓存
+        bool m_lent_children = false;
+        // 调用memoize_dump()之后才会创建
+        mutable std::atomic<DumpCache*> m_dump_cache{nullptr};
+        // 缓存的结构哈希，0表示还没有计算
+        mutable std::atomic<size_t> m_hash{0};
+        // 节点从哪里分配，nullptr表示用的是new
+        std::pmr::memory_resource* m_resource = nullptr;
+    };
+
+    /*
+     * 引用计数
+     * 非原子的方式也用std::atomic保存，只是读和写分开进行，编译出来就是普通的加减
+     */
+    inline void JsonValue::retain() const noexcept {
+        if(m_ref_mode == REF_ATOMIC){
+            m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        else{
+            m_refs.store(m_refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    inline bool JsonValue::release() const noexcept {
+        if(m_ref_mode == REF_ATOMIC){
+            return m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+        const uint32_t refs = m_refs.load(std::memory_order_relaxed) - 1;
+        m_refs.store(refs, std::memory_order_relaxed);
+        return refs == 0;
+    }
+
+    inline Json::Json() noexcept : m_ptr(nullptr), m_kind(INLINE_NULL) {}
+    inline Json::Json(std::nullptr_t) noexcept : m_ptr(nullptr), m_kind(INLINE_NULL) {}
+    inline Json::Json(double value) : m_double(value), m_kind(INLINE_DOUBLE) {}
+    inline Json::Json(int value) : m_int(value), m_kind(INLINE_INT) {}
+    inline Json::Json(bool value) : m_bool(value), m_kind(INLINE_BOOL) {}
+
+    inline void Json::copy_from(const Json& other) noexcept {
+        m_kind = other.m_kind;
+        switch(m_kind){
+            case INLINE_NULL:   m_ptr = nullptr; break;
+            case INLINE_BOOL:   m_bool = other.m_bool; break;
+            case INLINE_INT:    m_int = other.m_int; break;
+            case INLINE_DOUBLE: m_double = other.m_double; break;
+            case HEAP:          m_ptr = other.m_ptr; break;
+        }
+    }
+
+    inline Json::Json(const Json& other) {
+        if(other.m_kind == HEAP && other.m_ptr->m_lent_children){
+            m_kind = INLINE_NULL;
+            *this = other.clone_lent();
+            return;
+        }
+        copy_from(other);
+        if(m_kind == HEAP){
+            m_ptr->retain();
+        }
+    }
+
+    inline Json::Json(Json&& other) noexcept {
+        copy_from(other);
+        other.m_ptr = nullptr;
+        other.m_kind = INLINE_NULL;
+    }
+
+    inline Json& Json::operator=(const Json& other) {
+        if(other.m_kind == HEAP && other.m_ptr->m_lent_children){
+            if(this != &other){
+                *this = other.clone_lent();
+            }
+            return *this;
+        }
+        // 先增加再减少，自己给自己赋值时也不会被提前释放
+        if(other.m_kind == HEAP){
+            other.m_ptr->retain();
+        }
+        if(m_kind == HEAP && m_ptr->release()){
+            m_ptr->destroy();
+        }
+        copy_from(other);
+        return *this;
+    }
+
+    inline Json& Json::operator=(Json&& other) noexcept {
+        // 先接管other，再释放原来的节点，other可能就在原来的树里
+        const Kind old_kind = m_kind;
+        JsonValue* const old_ptr = m_ptr;
+        copy_from(other);
+        other.m_ptr = nullptr;
+        other.m_kind = INLINE_NULL;
+        if(old_kind == HEAP && old_ptr->release()){
+            old_ptr->destroy();
+        }
+        return *this;
+    }
+
+    inline Json::~Json() {
+        if(m_kind == HEAP && m_ptr->release()){
+            m_ptr->destroy();
+        }
+    }
+
+    inline Json::Type Json::type() const {
+        switch(m_kind){
+            case INLINE_NULL:   return NUL;
+            case INLINE_BOOL:   return BOOL;
+            case INLINE_INT:
+            case INLINE_DOUBLE: return NUMBER;
+            default:            return m_ptr->type();
+        }
+    }
+
+    /*
+     * 流式写出Json
+     * 不需要先构建一棵Json树，边调用边输出
+     * 转义、数字格式和分隔符与dump()完全一致
+     * Debug下会用assert检查嵌套是否合法，比如key()只能出现在对象中
+     */
+    class JsonWriter final{
+    public:
+        explicit JsonWriter(JsonSink& out, const DumpOptions& options = DumpOptions());
+        explicit JsonWriter(std::string& out, const DumpOptions& options = DumpOptions());
+        ~JsonWriter();
+
+        JsonWriter(const JsonWriter&) = delete;
+        JsonWriter& operator=(const JsonWriter&) = delete;
+
+        JsonWriter& begin_object();
+        JsonWriter& end_object();
+        JsonWriter& begin_array();
+        JsonWriter& end_array();
+        JsonWriter& key(const std::string& name);
+        JsonWriter& key(const char* name);
+
+        JsonWriter& value(std::nullptr_t);
+        JsonWriter& value(double number);
+        JsonWriter& value(int number);
+        JsonWriter& value(bool boolean);
+        JsonWriter& value(const std::string& str);
+        JsonWriter& value(const char* str);
+        // 已有的Json子树直接嵌入
+        JsonWriter& value(const Json& json);
+
+        // 根节点是否已经写完；析构时还有没关闭的容器或者键后面没有值，调试版本会断言
+        bool done() const { return m_done; }
+        void flush();
+
+    private:
+        struct Frame{
+            // '['或者'{'
+            char kind;
+            bool empty;
+        };
+
+        // 写一个值（或者容器的开头）之前，处理分隔符和换行
+        void before_value();
+        // 按长度写出键，键中可以有'\0'
+        JsonWriter& write_key(const char* name, size_t size);
+
+        DumpOptions m_options;
+        std::unique_ptr<StringSink> m_string_sink;
+        std::unique_ptr<DumpState> m_state;
+        std::vector<Frame> m_stack;
+        bool m_after_key = false;
+        bool m_done = false;
+    };
+    /*
+     * 二进制快照中的一个节点
+     * 只保存快照的地址和节点的偏移，不做任何解码，访问到哪里才读到哪里
+     * 访问器与Json保持一致；越界或者类型不对时返回默认值，和Json一样
+     * JsonView不持有快照，使用期间JsonSnapshot必须一直存在
+     */
+    class JsonView final{
+    public:
+        JsonView() {}
+
+        Json::Type type() const;
+        bool is_null()      const { return type() == Json::NUL; }
+        bool is_number()    const { return type() == Json::NUMBER; }
+        bool is_bool()      const { return type() == Json::BOOL; }
+        bool is_string()    const { return type() == Json::STRING; }
+        bool is_array()     const { return type() == Json::ARRAY; }
+        bool is_object()    const { return type() == Json::OBJECT; }
+
+        double number_value() const;
+        int int_value() const;
+        bool bool_value() const;
+        // 直接指向快照中的字节，不会拷贝
+        std::string_view string_value() const;
+
+        // 数组或对象的元素个数
+        size_t size() const;
+        JsonView operator[](size_t i) const;
+        // 对象的键在快照中是排好序的，这里是二分查找
+        JsonView operator[](std::string_view key) const;
+        // 按顺序访问对象的第i个成员
+        std::string_view key_at(size_t i) const;
+        JsonView value_at(size_t i) const;
+
+        // 遍历数组元素，用法和Json::array_items()一样：for(auto item : view.array_items())
+        class iterator{
+        public:
+            JsonView operator*() const;
+            iterator& operator++() { m_i++; return *this; }
+            bool operator==(const iterator& rhs) const { return m_i == rhs.m_i; }
+            bool operator!=(const iterator& rhs) const { return m_i != rhs.m_i; }
+        private:
+            friend class JsonView;
+            const char* m_base;
+            uint64_t m_size;
+            uint64_t m_offset;
+            size_t m_i;
+        };
+        struct Items{
+            iterator first;
+            iterator last;
+            iterator begin() const { return first; }
+            iterator end() const { return last; }
+        };
+        Items array_items() const;
+
+        // 完整解码成Json，有了它JsonView也可以隐式地转换成Json
+        Json to_json() const;
+
+    private:
+        friend class JsonSnapshot;
+        JsonView(const char* base, uint64_t size, uint64_t offset)
+            : m_base(base), m_size(size), m_offset(offset) {}
+
+        const char* m_base = nullptr;
+        uint64_t m_size = 0;
+        uint64_t m_offset = 0;
+    };
+
+    /*
+     * 只读的二进制快照
+     * 打开时只检查文件头，是O(1)的；之后由JsonView按需读取
+     * 用mmap打开时多个进程共享同一份page cache
+     */
+    class JsonSnapshot final{
+    public:
+        // mmap打开快照文件，失败时返回nullptr并设置err
+        static std::shared_ptr<JsonSnapshot> open(const std::string& path, std::string& err);
+        // 使用内存中的快照数据
+        static std::shared_ptr<JsonSnapshot> from_buffer(std::string bytes, std::string& err);
+        ~JsonSnapshot();
+
+        JsonSnapshot(const JsonSnapshot&) = delete;
+        JsonSnapshot& operator=(const JsonSnapshot&) = delete;
+
+        JsonView root() const;
+
+    private:
+        JsonSnapshot() {}
+        bool check_header(std::string& err);
+
+        const char* m_data = nullptr;
+        uint64_t m_size = 0;
+        // mmap的长度，为0说明数据在m_buffer中
+        size_t m_mapped = 0;
+        std::string m_buffer;
+    };
+} // namespace json11
+
+// 可以作为unordered容器的键
+namespace std{
+    template<>
+    struct hash<json11::Json>{
+        size_t operator()(const json11::Json& value) const { return value.hash(); }
     };
-} // namespace json11
\ No newline at end of file
+}